@@ -0,0 +1,302 @@
+// Microbenchmarks for the cost of crossing the C++/Julia boundary. Every
+// JuliaCpp operation is measured next to the equivalent raw Julia C API
+// code, so the difference is the overhead added by the header.
+//
+// Usage: bench [output file] (default: ../bench_output.txt)
+// Each line of the output file is: group, name, variant, size, ns per operation
+// (tab separated).
+
+#include "juliacpp.hpp"
+
+#include <chrono>
+#include <cstdio>
+
+using namespace jlcpp;
+
+namespace
+{
+	struct Result
+	{
+		std::string _group;
+		std::string _name;
+		std::string _variant;
+		size_t _size;
+		double _nsPerOp;
+	};
+
+	std::vector<Result> results;
+
+	// Best of several batches. The first call is excluded since it includes
+	// compiling the Julia function.
+	template <typename F>
+	void measure(const std::string& group, const std::string& name, const std::string& variant, size_t size, F&& f)
+	{
+		using Clock = std::chrono::steady_clock;
+		f();
+
+		size_t iterations = 1;
+		double best = std::numeric_limits<double>::max();
+		for (int batch = 0; batch < 5; )
+		{
+			const auto start = Clock::now();
+			for (size_t i = 0; i < iterations; i++)
+				f();
+			const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+
+			// Grow batches until timer resolution does not matter
+			if (elapsed.count() < 1e7)
+			{
+				iterations *= 2;
+				continue;
+			}
+
+			best = std::min(best, elapsed.count() / iterations);
+			batch++;
+		}
+
+		results.push_back(Result { group, name, variant, size, best });
+		std::printf("%-10s %-24s %-10s %8zu %12.1f ns\n", group.c_str(), name.c_str(), variant.c_str(), size, best);
+	}
+
+	void checkException()
+	{
+		JULIACPP_ASSERT(jl_exception_occurred() == nullptr, jl_typeof_str(jl_exception_occurred()));
+	}
+
+	void benchArity(JuliaModule& module, jl_module_t* jlModule)
+	{
+		measure("arity", "0", "juliacpp", 0, [&] { module.call("arity0"); });
+		measure("arity", "1", "juliacpp", 0, [&] { module.call("arity1", 1.0); });
+		measure("arity", "2", "juliacpp", 0, [&] { module.call("arity2", 1.0, 2.0); });
+		measure("arity", "3", "juliacpp", 0, [&] { module.call("arity3", 1.0, 2.0, 3.0); });
+		measure("arity", "4", "juliacpp", 0, [&] { module.call("arity4", 1.0, 2.0, 3.0, 4.0); });
+
+		jl_function_t* arity[] = {
+			jl_get_function(jlModule, "arity0"), jl_get_function(jlModule, "arity1"), jl_get_function(jlModule, "arity2"),
+			jl_get_function(jlModule, "arity3"), jl_get_function(jlModule, "arity4") };
+
+		for (size_t n = 0; n <= 4; n++)
+		{
+			measure("arity", std::to_string(n), "capi", 0, [&] {
+				jl_value_t** args;
+				JL_GC_PUSHARGS(args, 4);
+				for (size_t i = 0; i < n; i++)
+					args[i] = jl_box_float64((double)i);
+				jl_call(arity[n], args, (int32_t)n);
+				JL_GC_POP();
+				checkException();
+			});
+		}
+	}
+
+	template <typename T>
+	void benchScalar(JuliaModule& module, jl_function_t* roundtrip, const std::string& name, T value, jl_value_t* (*box)(T), T (*unbox)(jl_value_t*))
+	{
+		measure("scalar", name, "juliacpp", 0, [&] { volatile T result = module.call<T>("roundtrip", value); (void)result; });
+		measure("scalar", name, "capi", 0, [&] {
+			jl_value_t* arg = box(value);
+			volatile T result = unbox(jl_call1(roundtrip, arg));
+			(void)result;
+			checkException();
+		});
+	}
+
+	std::string unboxString(jl_value_t* value) { return jl_string_data(value); }
+	jl_value_t* boxString(std::string value) { return jl_cstr_to_string(value.c_str()); }
+
+	void benchScalars(JuliaModule& module, jl_module_t* jlModule)
+	{
+		jl_function_t* roundtrip = jl_get_function(jlModule, "roundtrip");
+
+		benchScalar<bool>(module, roundtrip, "bool", true, [](bool v) { return jl_box_bool(v); }, [](jl_value_t* v) { return jl_unbox_bool(v) != 0; });
+		benchScalar<int8_t>(module, roundtrip, "int8", 1, jl_box_int8, jl_unbox_int8);
+		benchScalar<int16_t>(module, roundtrip, "int16", 1, jl_box_int16, jl_unbox_int16);
+		benchScalar<int32_t>(module, roundtrip, "int32", 1, jl_box_int32, jl_unbox_int32);
+		benchScalar<int64_t>(module, roundtrip, "int64", 1, jl_box_int64, jl_unbox_int64);
+		benchScalar<uint8_t>(module, roundtrip, "uint8", 1, jl_box_uint8, jl_unbox_uint8);
+		benchScalar<uint16_t>(module, roundtrip, "uint16", 1, jl_box_uint16, jl_unbox_uint16);
+		benchScalar<uint32_t>(module, roundtrip, "uint32", 1, jl_box_uint32, jl_unbox_uint32);
+		benchScalar<uint64_t>(module, roundtrip, "uint64", 1, jl_box_uint64, jl_unbox_uint64);
+		benchScalar<float>(module, roundtrip, "float32", 1.5f, jl_box_float32, jl_unbox_float32);
+		benchScalar<double>(module, roundtrip, "float64", 1.5, jl_box_float64, jl_unbox_float64);
+
+		const std::string text = "benchmark string";
+		measure("scalar", "string", "juliacpp", text.size(), [&] { std::string result = module.call<std::string>("roundtrip", text); });
+		measure("scalar", "string", "capi", text.size(), [&] {
+			jl_value_t* arg = boxString(text);
+			std::string result = unboxString(jl_call1(roundtrip, arg));
+			checkException();
+		});
+	}
+
+	void benchArrays(JuliaModule& module, jl_module_t* jlModule)
+	{
+		jl_function_t* sumArray = jl_get_function(jlModule, "sumArray");
+		jl_value_t* arrayType = jl_apply_array_type(jl_float64_type, 1);
+
+		for (size_t size : { 16, 1024, 65536 })
+		{
+			const std::vector<double> constArray(size, 1.0);
+			std::vector<double> array(size, 1.0);
+
+			// const arrays are copied into a new Julia array, non-const arrays are shared
+			measure("array", "sum const", "juliacpp", size, [&] { volatile double s = module.call<double>("sumArray", constArray); (void)s; });
+			measure("array", "sum const", "capi", size, [&] {
+				jl_array_t* jlArray = jl_alloc_array_1d(arrayType, size);
+				std::memcpy(jl_array_data(jlArray), constArray.data(), size * sizeof(double));
+				volatile double s = jl_unbox_float64(jl_call1(sumArray, (jl_value_t*)jlArray));
+				(void)s;
+				checkException();
+			});
+
+			measure("array", "sum shared", "juliacpp", size, [&] { volatile double s = module.call<double>("sumArray", array); (void)s; });
+			measure("array", "sum shared", "capi", size, [&] {
+				jl_array_t* jlArray = jl_ptr_to_array_1d(arrayType, array.data(), size, 0);
+				volatile double s = jl_unbox_float64(jl_call1(sumArray, (jl_value_t*)jlArray));
+				(void)s;
+				checkException();
+			});
+		}
+	}
+
+	void benchNestedArrays(JuliaModule& module, jl_module_t* jlModule)
+	{
+		jl_function_t* roundtrip = jl_get_function(jlModule, "roundtrip");
+		jl_value_t* innerType = jl_apply_array_type(jl_float64_type, 1);
+		jl_value_t* outerType = jl_apply_array_type((jl_datatype_t*)innerType, 1);
+		jl_value_t* stringArrayType = jl_apply_array_type(jl_string_type, 1);
+
+		const size_t rows = 16, columns = 16;
+		const std::vector<std::vector<double>> nested(rows, std::vector<double>(columns, 1.0));
+
+		measure("nested", "roundtrip", "juliacpp", rows * columns, [&] { std::vector<std::vector<double>> result = module.call<std::vector<std::vector<double>>>("roundtrip", nested); });
+		measure("nested", "roundtrip", "capi", rows * columns, [&] {
+			jl_array_t* outer = jl_alloc_array_1d(outerType, rows);
+			JL_GC_PUSH1(&outer);
+			for (size_t i = 0; i < rows; i++)
+			{
+				jl_array_t* inner = jl_alloc_array_1d(innerType, columns);
+				std::memcpy(jl_array_data(inner), nested[i].data(), columns * sizeof(double));
+				jl_arrayset(outer, (jl_value_t*)inner, i);
+			}
+			jl_array_t* ret = (jl_array_t*)jl_call1(roundtrip, (jl_value_t*)outer);
+			JL_GC_POP();
+			checkException();
+
+			std::vector<std::vector<double>> result(jl_array_len(ret));
+			for (size_t i = 0; i < result.size(); i++)
+			{
+				jl_array_t* inner = (jl_array_t*)jl_array_ptr_data(ret)[i];
+				const double* data = (const double*)jl_array_data(inner);
+				result[i].assign(data, data + jl_array_len(inner));
+			}
+		});
+
+		const std::vector<std::string> strings(64, "benchmark string");
+
+		measure("nested", "strings", "juliacpp", strings.size(), [&] { std::vector<std::string> result = module.call<std::vector<std::string>>("roundtrip", strings); });
+		measure("nested", "strings", "capi", strings.size(), [&] {
+			jl_array_t* array = jl_alloc_array_1d(stringArrayType, strings.size());
+			JL_GC_PUSH1(&array);
+			for (size_t i = 0; i < strings.size(); i++)
+				jl_arrayset(array, jl_cstr_to_string(strings[i].c_str()), i);
+			jl_array_t* ret = (jl_array_t*)jl_call1(roundtrip, (jl_value_t*)array);
+			JL_GC_POP();
+			checkException();
+
+			std::vector<std::string> result(jl_array_len(ret));
+			for (size_t i = 0; i < result.size(); i++)
+				result[i] = jl_string_data(jl_array_ptr_data(ret)[i]);
+		});
+	}
+
+	void benchKeywordArgs(JuliaModule& module, jl_module_t* jlModule)
+	{
+		jl_function_t* func = jl_get_function(jlModule, "keywordFunction");
+		jl_function_t* kwsorter = jl_gf_mtable(func)->kwsorter;
+		jl_value_t* anyArrayType = jl_apply_array_type(jl_any_type, 1);
+
+		measure("kwargs", "1 keyword", "juliacpp", 1, [&] { volatile double r = module.call<double>("keywordFunction", 2.0, KeywordArgs("scale", 3.0)); (void)r; });
+		measure("kwargs", "1 keyword", "capi", 1, [&] {
+			jl_value_t** args;
+			JL_GC_PUSHARGS(args, 3);
+			jl_array_t* keywords = jl_alloc_array_1d(anyArrayType, 2);
+			args[0] = (jl_value_t*)keywords;
+			jl_arrayset(keywords, (jl_value_t*)jl_symbol("scale"), 0);
+			jl_arrayset(keywords, jl_box_float64(3.0), 1);
+			args[1] = func;
+			args[2] = jl_box_float64(2.0);
+			volatile double r = jl_unbox_float64(jl_call(kwsorter, args, 3));
+			(void)r;
+			JL_GC_POP();
+			checkException();
+		});
+	}
+
+	void benchReturns(JuliaModule& module, jl_module_t* jlModule)
+	{
+		jl_function_t* roundtrip2 = jl_get_function(jlModule, "roundtrip2");
+		jl_function_t* fillArray = jl_get_function(jlModule, "fillArray");
+
+		measure("return", "tuple", "juliacpp", 2, [&] {
+			double a;
+			int64_t b;
+			jlcpp::tie(a, b) = module.call("roundtrip2", 1.0, (int64_t)2);
+		});
+		measure("return", "tuple", "capi", 2, [&] {
+			jl_value_t* a = nullptr;
+			jl_value_t* b = nullptr;
+			jl_value_t* ret = nullptr;
+			JL_GC_PUSH3(&a, &b, &ret);
+			a = jl_box_float64(1.0);
+			b = jl_box_int64(2);
+			ret = jl_call2(roundtrip2, a, b);
+			checkException();
+			volatile double ra = jl_unbox_float64(jl_get_nth_field(ret, 0));
+			volatile int64_t rb = jl_unbox_int64(jl_get_nth_field(ret, 1));
+			(void)ra; (void)rb;
+			JL_GC_POP();
+		});
+
+		for (size_t size : { 16, 1024, 65536 })
+		{
+			std::vector<double> out(size);
+
+			measure("return", "array", "juliacpp", size, [&] { std::vector<double> result = module.call<std::vector<double>>("fillArray", (int64_t)size); });
+			measure("return", "array noAlloc", "juliacpp", size, [&] { noAlloc(out) = module.call("fillArray", (int64_t)size); });
+			measure("return", "array noAlloc", "capi", size, [&] {
+				jl_array_t* ret = (jl_array_t*)jl_call1(fillArray, jl_box_int64((int64_t)size));
+				checkException();
+				std::memcpy(out.data(), jl_array_data(ret), jl_array_len(ret) * sizeof(double));
+			});
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const std::string outputPath = argc > 1 ? argv[1] : "../bench_output.txt";
+
+	initJulia(JULIA_INIT_DIR);
+
+	{
+		JuliaModule module("../bench/bench.jl", "JuliaCppBench");
+		jl_module_t* jlModule = (jl_module_t*)jl_get_global(jl_current_module, jl_symbol("JuliaCppBench"));
+		JULIACPP_ASSERT(jlModule != nullptr, "Module 'JuliaCppBench' not found.");
+
+		benchArity(module, jlModule);
+		benchScalars(module, jlModule);
+		benchArrays(module, jlModule);
+		benchNestedArrays(module, jlModule);
+		benchKeywordArgs(module, jlModule);
+		benchReturns(module, jlModule);
+	}
+
+	std::ofstream file(outputPath);
+	file << "# group\tname\tvariant\tsize\tns_per_op\n";
+	for (auto& result : results)
+		file << result._group << '\t' << result._name << '\t' << result._variant << '\t' << result._size << '\t' << result._nsPerOp << '\n';
+
+	shutdownJulia();
+	return 0;
+}
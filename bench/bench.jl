@@ -0,0 +1,28 @@
+module JuliaCppBench
+
+arity0() = nothing
+arity1(a) = nothing
+arity2(a, b) = nothing
+arity3(a, b, c) = nothing
+arity4(a, b, c, d) = nothing
+
+roundtrip(val) = val
+roundtrip2(a, b) = a, b
+
+function sumArray(val)
+  s = zero(eltype(val))
+  for x in val
+    s += x
+  end
+  return s
+end
+
+function fillArray(n)
+  return ones(Float64, n)
+end
+
+function keywordFunction(a; scale=1.0)
+  return a * scale
+end
+
+end
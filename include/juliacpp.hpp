@@ -5,12 +5,41 @@
 #include <vector>
 #include <array>
 #include <map>
+#include <unordered_map>
 #include <tuple>
 #include <memory>
 #include <cstring> // std::memcpy
+#include <cstddef> // offsetof
 #include <iostream>
 #include <sstream>
 #include <type_traits>
+#include <algorithm>
+#include <complex>
+#include <limits>
+#include <cmath>
+#include <atomic>
+#include <mutex>
+#include <cstdlib> // realpath
+#include <fstream>
+#include <set>
+#include <thread>
+#include <future>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <chrono>
+#include <cstdio>
+
+// Define before including juliacpp.hpp to use HotReloader (Linux only). It
+// is opt-in so that other users do not pay for the additional headers.
+//#define JULIACPP_ENABLE_HOT_RELOAD
+
+#if defined(JULIACPP_ENABLE_HOT_RELOAD) && defined(__linux__)
+#include <regex>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
 
 namespace jlcpp
 {
@@ -51,8 +80,26 @@ private:
 #define JULIACPP_ASSERT(EXPRESSION, MESSAGE) if(!(EXPRESSION)) { throw JuliaCppException(#EXPRESSION, __FILE__, __LINE__, MESSAGE); }
 #define JULIACPP_ASSERT_NOMSG(EXPRESSION) if(!(EXPRESSION)) { throw JuliaCppException(#EXPRESSION, __FILE__, __LINE__, ""); }
 
+// Interns a string literal once per call site
+#define JULIACPP_SYMBOL(NAME) ([]() -> jl_sym_t* { static jl_sym_t* const symbol = jl_symbol(NAME); return symbol; }())
+
+// Looks up a function of the JuliaCppHelpers module once per call site
+#define JULIACPP_HELPER(NAME) ([]() -> jl_function_t* { static jl_function_t* const func = Impl::helperFunction(JULIACPP_SYMBOL(NAME)); return func; }())
+
 //#define ENABLE_LOG
 
+// Invoking a resolved method instance relies on jl_get_specialization1 and
+// jl_invoke, whose signatures changed after Julia 0.6
+#if JULIA_VERSION_MAJOR == 0 && JULIA_VERSION_MINOR >= 6
+#define JULIACPP_HAS_DIRECT_INVOKE
+#endif
+
+// Define before including juliacpp.hpp to time the phases of every
+// JuliaModule::call, see getCallStats(). The class layouts do not depend on
+// it, but the inline call path does: define it for all translation units of
+// a program or for none, otherwise the linker keeps either version.
+//#define JULIACPP_ENABLE_CALL_STATS
+
 #ifdef ENABLE_LOG
 inline void log(const char* f, ...)
 {
@@ -68,10 +115,108 @@ inline void log(const char*, ...)
 }
 #endif
 
+// IEEE 754 half-precision storage type, mapped to Julia's Float16. Values
+// are converted to float for arithmetic; arrays of Float16 are passed without
+// widening.
+struct Float16
+{
+	Float16() : _bits(0) { }
+	Float16(float value) : _bits(fromFloat(value)) { }
+
+	static Float16 fromBits(uint16_t bits)
+	{
+		Float16 value;
+		value._bits = bits;
+		return value;
+	}
+
+	operator float() const { return toFloat(_bits); }
+
+	uint16_t _bits;
+
+private:
+	static uint32_t floatBits(float value) { uint32_t bits; std::memcpy(&bits, &value, sizeof(bits)); return bits; }
+	static float bitsFloat(uint32_t bits) { float value; std::memcpy(&value, &bits, sizeof(value)); return value; }
+
+	// Round to nearest even, overflow to infinity
+	static uint16_t fromFloat(float value)
+	{
+		const uint32_t f32Infinity = 255u << 23;
+		const uint32_t f16Max = (127u + 16) << 23;
+		const uint32_t denormMagic = ((127u - 15) + (23 - 10) + 1) << 23;
+
+		uint32_t bits = floatBits(value);
+		const uint32_t sign = bits & 0x80000000u;
+		bits ^= sign;
+
+		uint16_t half;
+		if (bits >= f16Max)
+		{
+			half = bits > f32Infinity ? 0x7e00 : 0x7c00; // NaN or infinity
+		}
+		else if (bits < (113u << 23))
+		{
+			// Subnormal half: let the float adder do the rounding
+			half = (uint16_t)(floatBits(bitsFloat(bits) + bitsFloat(denormMagic)) - denormMagic);
+		}
+		else
+		{
+			const uint32_t mantissaOdd = (bits >> 13) & 1;
+			bits += ((uint32_t)(15 - 127) << 23) + 0xfff;
+			bits += mantissaOdd;
+			half = (uint16_t)(bits >> 13);
+		}
+
+		return (uint16_t)(half | (sign >> 16));
+	}
+
+	static float toFloat(uint16_t half)
+	{
+		const uint32_t magic = 113u << 23;
+		const uint32_t shiftedExponent = 0x7c00u << 13;
+
+		uint32_t bits = (uint32_t)(half & 0x7fff) << 13;
+		const uint32_t exponent = shiftedExponent & bits;
+		bits += (127u - 15) << 23;
+
+		if (exponent == shiftedExponent)
+		{
+			bits += (128u - 16) << 23; // NaN or infinity
+		}
+		else if (exponent == 0)
+		{
+			bits += 1u << 23; // subnormal
+			bits = floatBits(bitsFloat(bits) - bitsFloat(magic));
+		}
+
+		return bitsFloat(bits | ((uint32_t)(half & 0x8000) << 16));
+	}
+};
+
+static_assert(sizeof(Float16) == 2, "Float16 must be layout-compatible with Julia's Float16.");
+static_assert(sizeof(std::complex<float>) == 2 * sizeof(float), "std::complex<float> must be layout-compatible with ComplexF32.");
+
+// Phases of JuliaModule::call timed when JULIACPP_ENABLE_CALL_STATS is defined
+enum class CallPhase
+{
+	Box,       // Converting arguments to Julia values
+	Dispatch,  // jl_call, including the Julia function itself
+	Exception, // Checking for and reporting Julia exceptions
+	Unbox      // Converting the returned value to C++
+};
+
+// Checks performed by convertTo when converting numeric values
+enum class ConversionCheck
+{
+	None,  // Plain static_cast
+	Range, // Values must fit into the target type
+	Exact  // Values must convert back to the original value
+};
+
 template<typename T>
 struct ArrayPointer
 {
-	ArrayPointer() { }
+	ArrayPointer() : _data(nullptr), _len(0) { }
 
 	ArrayPointer(T* data, size_t len)
 		: _data(data), _len(len)
@@ -106,6 +251,48 @@ struct ArrayPointer
 	}
 };
 
+// Variable-length rows stored as one flat values buffer plus row offsets.
+// Row i spans _values[_offsets[i]] to _values[_offsets[i+1]] (exclusive).
+// In Julia, a RaggedArray appears as a vector of views into a single array.
+template<typename T>
+struct RaggedArray
+{
+	RaggedArray() : _offsets(1, 0) { }
+
+	std::vector<T> _values;
+	std::vector<int64_t> _offsets;
+
+	size_t size() const { return _offsets.size() - 1; }
+	size_t length(size_t i) const { return (size_t)(_offsets[i+1] - _offsets[i]); }
+
+	ArrayPointer<T> operator[](size_t i) { return ArrayPointer<T>(_values.data() + _offsets[i], length(i)); }
+	ArrayPointer<const T> operator[](size_t i) const { return ArrayPointer<const T>(_values.data() + _offsets[i], length(i)); }
+
+	void append(const T* data, size_t len)
+	{
+		_values.insert(_values.end(), data, data + len);
+		_offsets.push_back((int64_t)_values.size());
+	}
+
+	template<typename TArray>
+	void append(const TArray& row)
+	{
+		_values.insert(_values.end(), std::begin(row), std::end(row));
+		_offsets.push_back((int64_t)_values.size());
+	}
+
+	void clear()
+	{
+		_values.clear();
+		_offsets.assign(1, 0);
+	}
+
+	bool operator==(const RaggedArray<T>& rhs) const
+	{
+		return _values == rhs._values && _offsets == rhs._offsets;
+	}
+};
+
 namespace Impl
 {
 	template <std::size_t... Is>
@@ -150,782 +337,4030 @@ namespace Impl
 		static constexpr bool value = TypeOccurrenceCounter<T, TArgs...>::value <= 1;
 	};
 
-	template <typename T> inline jl_datatype_t* dataTypeOf()
+	// Julia functions used internally by JuliaCpp. The module is evaluated once
+	// on first use.
+	static const char* helperModuleSource = R"julia(
+module JuliaCppHelpers
+
+raggedViews(values, offsets) = [view(values, (offsets[i] + 1):offsets[i + 1]) for i in 1:(length(offsets) - 1)]
+
+# Copies row by row instead of splatting into vcat, which compiles a new
+# method for every row count
+function raggedFlatten(rows)
+  offsets = zeros(Int64, length(rows) + 1)
+  T = Union{}
+  for i in 1:length(rows)
+    isa(rows[i], AbstractVector) || throw(ArgumentError("RaggedArray rows must be vectors"))
+    offsets[i + 1] = offsets[i] + length(rows[i])
+    T = promote_type(T, eltype(rows[i]))
+  end
+  values = Vector{T === Union{} ? Any : T}()
+  sizehint!(values, offsets[end])
+  for row in rows
+    append!(values, row)
+  end
+  return values, offsets
+end
+
+function addPackagePaths(loadPath::String, depotPath::String)
+  isempty(loadPath) || loadPath in LOAD_PATH || push!(LOAD_PATH, loadPath)
+  if !isempty(depotPath)
+    cachePaths = isdefined(Base, :DEPOT_PATH) ? Base.DEPOT_PATH : Base.LOAD_CACHE_PATH
+    depotPath in cachePaths || insert!(cachePaths, 1, depotPath)
+  end
+  return nothing
+end
+
+function requirePackage(name::String)
+  sym = Symbol(name)
+  if VERSION < v"0.7.0-"
+    Base.require(sym)
+    return getfield(Main, sym)
+  end
+  return Base.require(Main, sym)
+end
+
+function loadStaged(path::String)
+  staging = Module(:JuliaCppStaging)
+  if VERSION < v"0.7.0-"
+    Core.eval(staging, :(include($path)))
+  else
+    Base.include(staging, path)
+  end
+  return staging
+end
+
+# The name under which a normal load binds the module. Modules loaded by
+# loadStaged live in an anonymous JuliaCppStaging module instead.
+function publicModuleName(mod::Module)
+  names = fullname(mod)
+  if !isempty(names) && names[1] == :JuliaCppStaging
+    names = names[2:end]
+  end
+  return isempty(names) ? "Main" : join(names, ".")
+end
+
+function precompileStatement(mod::Module, name::String, types::Vector{Any})
+  return string("precompile(getfield(", publicModuleName(mod), ", Symbol(\"", name, "\")), Tuple{", join(map(string, types), ", "), "})")
+end
+
+# Keeps values referenced from C++ alive, see Impl::RootPool
+const rootPool = Any[]
+
+errorMessage(exception) = sprint(showerror, exception)
+
+function bitVectorFromChunks(chunks::Vector{UInt64}, len::Int64)
+  bits = falses(0)
+  bits.chunks = chunks
+  bits.len = len
+  return bits
+end
+
+end
+)julia";
+
+	// Symbols are never freed by Julia, so they can be cached by name instead
+	// of hashing the string into Julia's symbol table on every lookup. The
+	// cache is per thread so lookups don't contend on a lock.
+	inline jl_sym_t* internSymbol(const std::string& name)
 	{
-		static_assert(sizeof(T) == -1, "No jl_datatype_t found.");
-		return nullptr;
-	}
-
-	template <> inline jl_datatype_t* dataTypeOf<bool>() { return jl_bool_type; }
-	template <> inline jl_datatype_t* dataTypeOf<char>() { return jl_char_type; }
-	template <> inline jl_datatype_t* dataTypeOf<int8_t>() { return jl_int8_type; }
-	template <> inline jl_datatype_t* dataTypeOf<int16_t>() { return jl_int16_type; }
-	template <> inline jl_datatype_t* dataTypeOf<int32_t>() { return jl_int32_type; }
-	template <> inline jl_datatype_t* dataTypeOf<int64_t>() { return jl_int64_type; }
-	template <> inline jl_datatype_t* dataTypeOf<uint8_t>() { return jl_uint8_type; }
-	template <> inline jl_datatype_t* dataTypeOf<uint16_t>() { return jl_uint16_type; }
-	template <> inline jl_datatype_t* dataTypeOf<uint32_t>() { return jl_uint32_type; }
-	template <> inline jl_datatype_t* dataTypeOf<uint64_t>() { return jl_uint64_type; }
-	template <> inline jl_datatype_t* dataTypeOf<float>() { return jl_float32_type; }
-	template <> inline jl_datatype_t* dataTypeOf<double>() { return jl_float64_type; }
-	template <> inline jl_datatype_t* dataTypeOf<std::string>() { return jl_string_type; }
-	template <> inline jl_datatype_t* dataTypeOf<const char*>() { return jl_string_type; }
-
+		thread_local std::unordered_map<std::string, jl_sym_t*> symbols;
 
-	template<typename T>
-	struct TypeTraits
-	{
-		static constexpr bool isPtrArray = false;
-		static inline jl_datatype_t* dataType() { return dataTypeOf<UnqualifiedType<T>>(); }
-	};
+		auto it = symbols.find(name);
+		if (it != symbols.end())
+			return it->second;
 
-	template<>
-	struct TypeTraits<std::string>
-	{
-		static constexpr bool isPtrArray = true;
-		static inline jl_datatype_t* dataType() { return dataTypeOf<std::string>(); }
-	};
+		jl_sym_t* symbol = jl_symbol(name.c_str());
+		symbols.emplace(name, symbol);
+		return symbol;
+	}
 
-	template<>
-	struct TypeTraits<const char*>
+	inline jl_module_t* helperModule()
 	{
-		static constexpr bool isPtrArray = true;
-		static jl_datatype_t* dataType() { return dataTypeOf<const char*>(); }
-	};
+		static jl_module_t* module = nullptr;
+		if (module == nullptr)
+		{
+			jl_eval_string(helperModuleSource);
+			JULIACPP_ASSERT(jl_exception_occurred() == nullptr, "Could not evaluate JuliaCppHelpers.");
+			module = (jl_module_t*)jl_get_global(jl_current_module, JULIACPP_SYMBOL("JuliaCppHelpers"));
+			JULIACPP_ASSERT(module != nullptr, "Module 'JuliaCppHelpers' not found.");
+		}
+		return module;
+	}
 
-	template<typename T, size_t size>
-	struct TypeTraits<T[size]>
+	// Helper functions are never redefined, see JULIACPP_HELPER for caching them
+	inline jl_function_t* helperFunction(jl_sym_t* name)
 	{
-		static constexpr bool isPtrArray = true;
-		static jl_datatype_t* dataType() { return jl_array_type; }
-	};
+		jl_function_t* func = (jl_function_t*)jl_get_global(helperModule(), name);
+		JULIACPP_ASSERT(func != nullptr, std::string("Helper function '") + jl_symbol_name(name) + "' not found.");
+		return func;
+	}
 
-	template<typename T>
-	struct TypeTraits<ArrayPointer<T>>
+	// Set by shutdownJulia(), after which C++ objects that still hold Julia
+	// values must not call into Julia anymore
+	inline std::atomic<bool>& juliaShutDown()
 	{
-		static constexpr bool isPtrArray = true;
-		static jl_datatype_t* dataType() { return jl_array_type; }
-	};
+		static std::atomic<bool> shutDown(false);
+		return shutDown;
+	}
 
-	template<typename T, size_t N>
-	struct TypeTraits<std::array<T, N>>
+	// Slots in a Julia array that keep values alive while C++ holds them
+	// outside of a GC frame. Released slots are reused.
+	class RootPool
 	{
-		static constexpr bool isPtrArray = true;
-		static jl_datatype_t* dataType() { return jl_array_type; }
-	};
+	public:
+		static RootPool& instance()
+		{
+			static RootPool pool;
+			return pool;
+		}
 
-	template<typename T>
-	struct TypeTraits<std::vector<T>>
-	{
-		static constexpr bool isPtrArray = true;
-		static jl_datatype_t* dataType() { return jl_array_type; }
-	};
+		size_t add(jl_value_t* value)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			// Looking up the pool and growing it may allocate, so the value
+			// stays in this frame until it is stored
+			size_t slot;
+			JL_GC_PUSH1(&value);
+			jl_array_t* array = pool();
+			if (_free.empty())
+			{
+				jl_array_ptr_1d_push(array, value);
+				slot = jl_array_len(array) - 1;
+			}
+			else
+			{
+				slot = _free.back();
+				_free.pop_back();
+				jl_arrayset(array, value, slot);
+			}
+			JL_GC_POP();
+			return slot;
+		}
 
+		// nullptr once Julia has shut down
+		jl_value_t* get(size_t slot)
+		{
+			if (juliaShutDown())
+				return nullptr;
 
-	template <typename T>
-	using ValueIfPtrArray = typename std::enable_if<TypeTraits<UnqualifiedType<T>>::isPtrArray, jl_value_t*>::type;
-	template <typename T>
-	using ValueIfNotPtrArray = typename std::enable_if<!TypeTraits<UnqualifiedType<T>>::isPtrArray, jl_value_t*>::type;
+			std::lock_guard<std::mutex> lock(_mutex);
+			return jl_array_ptr_data(pool())[slot];
+		}
 
+		// Does nothing once Julia has shut down, so rooted values may outlive it
+		void release(size_t slot)
+		{
+			if (juliaShutDown())
+				return;
 
-	inline jl_value_t* box(bool val) { return jl_box_bool(val); }
-	inline jl_value_t* box(char val) { return jl_box_char((uint32_t)val); }
-	inline jl_value_t* box(int8_t val) { return jl_box_int8(val); }
-	inline jl_value_t* box(int16_t val) { return jl_box_int16(val); }
-	inline jl_value_t* box(int32_t val) { return jl_box_int32(val); }
-	inline jl_value_t* box(int64_t val) { return jl_box_int64(val); }
-	inline jl_value_t* box(uint8_t val) { return jl_box_uint8(val); }
-	inline jl_value_t* box(uint16_t val) { return jl_box_uint16(val); }
-	inline jl_value_t* box(uint32_t val) { return jl_box_uint32(val); }
-	inline jl_value_t* box(uint64_t val) { return jl_box_uint64(val); }
-	inline jl_value_t* box(float val) { return jl_box_float32(val); }
-	inline jl_value_t* box(double val) { return jl_box_float64(val); }
-	// Encoding for individual strings is handled by Julia. Julia strings are immutable.
-	inline jl_value_t* box(const std::string& val) { return jl_cstr_to_string(val.c_str()); }
-	inline jl_value_t* box(const char* val) { return jl_cstr_to_string(val); }
+			std::lock_guard<std::mutex> lock(_mutex);
+			jl_arrayset(pool(), jl_nothing, slot);
+			_free.push_back(slot);
+		}
 
-	template<typename T> ValueIfNotPtrArray<T> boxArray(T* data, size_t size);
-	template<typename T> ValueIfNotPtrArray<T> boxArray(const T* data, size_t size);
-	template<typename T> ValueIfPtrArray<T> boxArray(T* data, size_t size);
-	template<typename T> ValueIfPtrArray<T> boxArray(const T* data, size_t size);
+	private:
+		RootPool() : _pool(nullptr) { }
 
-	template<typename T, size_t N>
-	inline jl_value_t* box(T(& val)[N]) { return boxArray<T>(val, N); }
+		jl_array_t* pool()
+		{
+			if (_pool == nullptr)
+				_pool = (jl_array_t*)jl_get_global(helperModule(), JULIACPP_SYMBOL("rootPool"));
+			return _pool;
+		}
 
-	template<typename T>
-	inline jl_value_t* box(ArrayPointer<T>& val) { return boxArray<T>(val._data, val._len); }
+		std::mutex _mutex;
+		jl_array_t* _pool;
+		std::vector<size_t> _free;
+	};
 
-	template<typename T, size_t N>
-	inline jl_value_t* box(std::array<T, N>& val) { return boxArray<T>(val.data(), val.size()); }
+	// Keeps a Julia value in the RootPool while the object exists. Copies
+	// root the value again in a slot of their own.
+	class RootedValue
+	{
+	public:
+		RootedValue() : _slot(noSlot) { }
+		explicit RootedValue(jl_value_t* value) : _slot(noSlot) { reset(value); }
+		RootedValue(const RootedValue& other) : _slot(noSlot) { reset(other.get()); }
+		RootedValue(RootedValue&& other) : _slot(other._slot) { other._slot = noSlot; }
+		~RootedValue() { reset(nullptr); }
+
+		RootedValue& operator=(RootedValue other)
+		{
+			std::swap(_slot, other._slot);
+			return *this;
+		}
 
-	template<typename T, size_t N>
-	inline jl_value_t* box(const std::array<T, N>& val) { return boxArray<T>(val.data(), val.size()); }
+		jl_value_t* get() const { return _slot != noSlot ? RootPool::instance().get(_slot) : nullptr; }
 
-	template<typename T>
-	inline jl_value_t* box(std::vector<T>& val) { return boxArray<T>(val.data(), val.size()); }
+		void reset(jl_value_t* value)
+		{
+			const size_t slot = value != nullptr ? RootPool::instance().add(value) : noSlot;
+			if (_slot != noSlot)
+				RootPool::instance().release(_slot);
+			_slot = slot;
+		}
 
-	template<typename T>
-	inline jl_value_t* box(const std::vector<T>& val) { return boxArray<T>(val.data(), val.size()); }
+	private:
+		static constexpr size_t noSlot = (size_t)-1;
+		size_t _slot;
+	};
 
-	template<typename T>
-	ValueIfNotPtrArray<T> boxArray(T* data, size_t size)
+	// std::atomic with copy operations, for members of copyable classes
+	template <typename T>
+	struct CopyableAtomic
 	{
-		log("boxArray(T*) - jl_ptr_to_array_1d");
+		CopyableAtomic(T value = T()) : _value(value) { }
+		CopyableAtomic(const CopyableAtomic& other) : _value(other.load()) { }
 
-		jl_datatype_t* dataType = TypeTraits<UnqualifiedType<T>>::dataType();
-		JULIACPP_ASSERT(dataType != nullptr, "Data type not supported.");
+		CopyableAtomic& operator=(const CopyableAtomic& other) { store(other.load()); return *this; }
+		CopyableAtomic& operator=(T value) { store(value); return *this; }
 
-		jl_value_t* arrayType = jl_apply_array_type(dataType, 1);
-		jl_array_t* array = jl_ptr_to_array_1d(arrayType, data, size, 0);
+		T load() const { return _value.load(std::memory_order_acquire); }
+		void store(T value) { _value.store(value, std::memory_order_release); }
+		operator T() const { return load(); }
 
-		return (jl_value_t*)array;
-	}
+		std::atomic<T> _value;
+	};
 
-	template<typename T>
-	ValueIfNotPtrArray<T> boxArray(const T* data, size_t size)
+	// Serializes loading of lazy JuliaModules
+	inline std::mutex& loadMutex()
 	{
-		log("boxArray(const T*) - jl_alloc_array_1d and memcpy");
-
-		jl_datatype_t* dataType = TypeTraits<UnqualifiedType<T>>::dataType();
-		JULIACPP_ASSERT(dataType != nullptr, "Data type not supported.");
+		static std::mutex mutex;
+		return mutex;
+	}
 
-		jl_value_t* arrayType = jl_apply_array_type(dataType, 1);
-		jl_array_t* array = jl_alloc_array_1d(arrayType, size);
+	inline std::string jsonString(const std::string& value)
+	{
+		std::string result = "\"";
+		for (char c : value)
+		{
+			switch (c)
+			{
+				case '"': result += "\\\""; break;
+				case '\\': result += "\\\\"; break;
+				case '\n': result += "\\n"; break;
+				case '\t': result += "\\t"; break;
+				default:
+					if ((unsigned char)c < 0x20)
+					{
+						char escaped[8];
+						std::snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned)c);
+						result += escaped;
+					}
+					else
+					{
+						result += c;
+					}
+			}
+		}
+		return result + "\"";
+	}
+} // namespace Impl
 
-		std::memcpy(jl_array_data(array), data, sizeof(T) * size);
+// Timeline of boundary crossings in the Chrome trace event format, which
+// chrome://tracing and Perfetto can open. Spans are kept in a ring buffer, so
+// only the most recent ones are written. Module loads are always recorded;
+// calls, their phases, GC pauses and first calls require
+// JULIACPP_ENABLE_CALL_STATS.
+class TraceRecorder
+{
+public:
+	using Clock = std::chrono::steady_clock;
 
-		return (jl_value_t*)array;
+	static TraceRecorder& instance()
+	{
+		static TraceRecorder recorder;
+		return recorder;
 	}
 
-	template<typename T>
-	ValueIfPtrArray<T> boxArray(T* data, size_t size)
+	// Discards previous spans and keeps at most capacity spans from now on
+	void start(size_t capacity = 1 << 16)
 	{
-		log("boxArray(T*) - jl_alloc_array_1d and unbox per element");
+		JULIACPP_ASSERT(capacity > 0, "Trace capacity must not be 0.");
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_events.clear();
+			_capacity = capacity;
+			_next = 0;
+			_epoch = Clock::now();
+		}
+		_recording = true;
+	}
 
-		jl_datatype_t* dataType = TypeTraits<UnqualifiedType<T>>::dataType();
-		JULIACPP_ASSERT(dataType != nullptr, "Data type not supported.");
+	void stop() { _recording = false; }
 
-		jl_value_t* arrayType = jl_apply_array_type(dataType, 1);
+	bool isRecording() const { return _recording.load(std::memory_order_relaxed); }
 
-		jl_array_t* array = jl_alloc_array_1d(arrayType, size);
-		jl_value_t** arrayData = (jl_value_t**)jl_array_data(array);
-		for (size_t i = 0; i < size; i++)
+	// args is the content of the JSON object shown with the span, e.g. "\"size\":3"
+	void record(const char* category, const std::string& name, Clock::time_point start, Clock::time_point end, const std::string& args = "")
+	{
+		if (!isRecording())
+			return;
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		TraceEvent event { category, name, start - _epoch, end - start, threadId(), args };
+		if (_events.size() < _capacity)
 		{
-			arrayData[i] = box(data[i]);
+			_events.push_back(std::move(event));
+		}
+		else
+		{
+			_events[_next] = std::move(event);
+			_next = (_next + 1) % _capacity;
 		}
-
-		return (jl_value_t*)array;
 	}
 
-	template<typename T>
-	ValueIfPtrArray<T> boxArray(const T* data, size_t size)
+	size_t size() const
 	{
-		log("boxArray(const T*) - jl_alloc_array_1d and unbox per element");
-
-		jl_datatype_t* dataType = TypeTraits<UnqualifiedType<T>>::dataType();
-		JULIACPP_ASSERT(dataType != nullptr, "Data type not supported.");
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _events.size();
+	}
 
-		jl_value_t* arrayType = jl_apply_array_type(dataType, 1);
+	// Writes the buffered spans, oldest first
+	void write(const std::string& filePath) const
+	{
+		std::ofstream file(filePath);
+		JULIACPP_ASSERT(file.is_open(), "Could not open trace file '" + filePath + "'.");
 
-		jl_array_t* array = jl_alloc_array_1d(arrayType, size);
-		jl_value_t** arrayData = (jl_value_t**)jl_array_data(array);
-		for (size_t i = 0; i < size; i++)
+		std::lock_guard<std::mutex> lock(_mutex);
+		file << "{\"traceEvents\":[";
+		for (size_t i = 0; i < _events.size(); i++)
 		{
-			arrayData[i] = box(data[i]);
+			const TraceEvent& event = _events[(_next + i) % _events.size()];
+			const double start = std::chrono::duration<double, std::micro>(event._start).count();
+			const double duration = std::chrono::duration<double, std::micro>(event._duration).count();
+
+			file << (i > 0 ? ",\n" : "\n");
+			file << "{\"name\":" << Impl::jsonString(event._name) << ",\"cat\":\"" << event._category << "\",\"ph\":\"X\""
+				<< ",\"ts\":" << start << ",\"dur\":" << duration << ",\"pid\":1,\"tid\":" << event._threadId;
+			if (!event._args.empty())
+				file << ",\"args\":{" << event._args << "}";
+			file << "}";
 		}
-
-		return (jl_value_t*)array;
+		file << "\n]}\n";
 	}
 
+private:
+	TraceRecorder() : _recording(false), _capacity(1), _next(0) { }
 
-	template<typename T>
-	static T unbox(jl_value_t*)
+	struct TraceEvent
 	{
-		static_assert(sizeof(T) == -1, "No jl_value_t* unbox for type.");
+		const char* _category;
+		std::string _name;
+		Clock::duration _start;
+		Clock::duration _duration;
+		uint32_t _threadId;
+		std::string _args;
+	};
+
+	static uint32_t threadId()
+	{
+		static std::atomic<uint32_t> nextId(1);
+		static thread_local uint32_t id = nextId++;
+		return id;
 	}
 
-	template <> inline void unbox<void>(jl_value_t*) { }
-	template <> inline bool unbox<bool>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_bool(val)); return (bool)jl_unbox_bool(val); }
-	template <> inline int8_t unbox<int8_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_int8(val)); return jl_unbox_int8(val); }
-	template <> inline int16_t unbox<int16_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_int16(val)); return jl_unbox_int16(val); }
-	template <> inline int32_t unbox<int32_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_int32(val)); return jl_unbox_int32(val); }
-	template <> inline int64_t unbox<int64_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_int64(val)); return jl_unbox_int64(val); }
-	template <> inline uint8_t unbox<uint8_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_uint8(val)); return jl_unbox_uint8(val); }
-	template <> inline uint16_t unbox<uint16_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_uint16(val)); return jl_unbox_uint16(val); }
-	template <> inline uint32_t unbox<uint32_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_uint32(val)); return jl_unbox_uint32(val); }
-	template <> inline uint64_t unbox<uint64_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_uint64(val)); return jl_unbox_uint64(val); }
-	template <> inline float unbox<float>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_float32(val)); return jl_unbox_float32(val); }
-	template <> inline double unbox<double>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_float64(val)); return jl_unbox_float64(val); }
-	template <> inline std::string unbox<std::string>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_string(val)); return std::string(jl_string_data(val)); }
-	// Disabled for now, can be garbage collected by Julia
-	//template <> inline const char* unbox<const char*>(jl_value_t* val) { return jl_string_data(val); }
+	std::atomic<bool> _recording;
+	mutable std::mutex _mutex;
+	std::vector<TraceEvent> _events;
+	size_t _capacity;
+	size_t _next; // oldest event once the buffer is full
+	Clock::time_point _epoch;
+};
 
-	namespace Unboxer
+namespace Impl
+{
+	// Records a span from construction to destruction if tracing is active
+	class TraceSpan
 	{
-		template<typename... TReturns>
-		struct ValueUnboxer
+	public:
+		TraceSpan(const char* category, const std::string& name)
+			: _category(category), _active(TraceRecorder::instance().isRecording())
 		{
-			typedef std::tuple<TReturns...> type;
-
-			template <typename T>
-			static T unboxAt(jl_value_t* value, size_t index)
+			if (_active)
 			{
-				log("unboxing tuple at index %d", (int)index);
-				return ValueUnboxer<T>::apply(jl_fieldref(value, index));
+				_name = name;
+				_start = TraceRecorder::Clock::now();
 			}
+		}
 
-			template <typename... T, std::size_t... N>
-			static std::tuple<T...> makeTuple(jl_value_t* value, Indices<N...>)
-			{
-				return std::make_tuple(unboxAt<T>(value, N)...);
-			}
+		~TraceSpan()
+		{
+			if (_active)
+				TraceRecorder::instance().record(_category, _name, _start, TraceRecorder::Clock::now());
+		}
 
-			static type apply(jl_value_t* value)
-			{
-				constexpr auto numReturns = sizeof...(TReturns);
-				static_assert(numReturns > 1, "This function call is for tuples.");
+		TraceSpan(const TraceSpan&) = delete;
+		TraceSpan& operator=(const TraceSpan&) = delete;
 
-				JULIACPP_ASSERT(jl_is_tuple(value), "Returned value is not a tuple.");
-				JULIACPP_ASSERT(jl_nfields(value) == numReturns, "Julia did not return the expected number of values.")
+	private:
+		const char* _category;
+		std::string _name;
+		bool _active;
+		TraceRecorder::Clock::time_point _start;
+	};
 
-				return makeTuple<TReturns...>(value, typename IndicesBuilder<numReturns>::type());
-			}
-		};
+	// Per-function call statistics, see getCallStats(). Durations are kept in
+	// a histogram with four buckets per power of two nanoseconds, so
+	// percentiles are accurate to about 20%. All counters are atomic and
+	// updated without locks.
+	class PhaseHistogram
+	{
+	public:
+		static constexpr size_t subBuckets = 4;
+		static constexpr size_t numBuckets = 64 * subBuckets;
 
-		template <typename TArray, typename TElem>
-		static void unboxArray(jl_value_t* val, TArray& array)
+		PhaseHistogram() { reset(); }
+
+		void record(uint64_t ns)
 		{
-			static_assert(!std::is_const<TElem>::value, "Cannot unbox array of const type.");
-			JULIACPP_ASSERT(jl_is_array(val), "jl_value_t is not an array.");
+			_buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+			_count.fetch_add(1, std::memory_order_relaxed);
+			_totalNs.fetch_add(ns, std::memory_order_relaxed);
+		}
 
-			jl_array_t* jlArray = (jl_array_t*)val;
+		uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+		uint64_t totalNs() const { return _totalNs.load(std::memory_order_relaxed); }
 
-			const auto size = array.size();
-			JULIACPP_ASSERT(jlArray->length == size, "Invalid array length.");
-			if (jlArray->flags.ptrarray)
-			{
-				jl_value_t** data = (jl_value_t**)jlArray->data;
-				for (size_t i = 0; i < size; i++)
-				{
-					array[i] = ValueUnboxer<TElem>::apply(data[i]);
-				}
-			}
-			else
+		// Upper bound of the bucket containing the given quantile
+		uint64_t percentileNs(double quantile) const
+		{
+			const uint64_t total = count();
+			if (total == 0)
+				return 0;
+
+			const uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(quantile * total));
+			uint64_t seen = 0;
+			for (size_t i = 0; i < numBuckets; i++)
 			{
-				JULIACPP_ASSERT(jl_array_eltype(val) == TypeTraits<TElem>::dataType(), "Unexpected jl_array_t element type.");
-				std::memcpy(array.data(), jlArray->data, sizeof(TElem) * size);
+				seen += _buckets[i].load(std::memory_order_relaxed);
+				if (seen >= rank)
+					return bucketLimit(i);
 			}
+			return bucketLimit(numBuckets - 1);
 		}
 
-		template<>
-		struct ValueUnboxer<>
+		void reset()
 		{
-		};
+			for (auto& bucket : _buckets)
+				bucket.store(0, std::memory_order_relaxed);
+			_count.store(0, std::memory_order_relaxed);
+			_totalNs.store(0, std::memory_order_relaxed);
+		}
 
-		template<typename T>
-		struct ValueUnboxer<T>
+	private:
+		static size_t highestBit(uint64_t value)
 		{
-			typedef T type;
+#if defined(__GNUC__)
+			return 63 - (size_t)__builtin_clzll(value);
+#else
+			size_t bit = 0;
+			while (value >>= 1)
+				bit++;
+			return bit;
+#endif
+		}
 
-			static type apply(jl_value_t* value)
-			{
-				return unbox<T>(value);
-			}
-		};
+		static size_t bucketOf(uint64_t ns)
+		{
+			if (ns < subBuckets)
+				return (size_t)ns;
 
-		template<typename T, size_t N>
-		struct ValueUnboxer<std::array<T, N>>
+			const size_t exponent = highestBit(ns);
+			const size_t fraction = (size_t)(ns >> (exponent - 2)) & (subBuckets - 1);
+			return (exponent - 1) * subBuckets + fraction;
+		}
+
+		static uint64_t bucketLimit(size_t bucket)
 		{
-			typedef std::array<T, N> type;
+			if (bucket < subBuckets)
+				return bucket;
+
+			const size_t exponent = bucket / subBuckets + 1;
+			const uint64_t fraction = bucket % subBuckets;
+			if (exponent >= 63)
+				return std::numeric_limits<uint64_t>::max();
+			return ((subBuckets + fraction + 1) << (exponent - 2)) - 1;
+		}
 
-			static type apply(jl_value_t* val)
-			{
-				std::array<T, N> array;
-				unboxArray<std::array<T, N>, T>(val, array);
-				return array;
-			}
-		};
+		std::atomic<uint64_t> _buckets[numBuckets];
+		std::atomic<uint64_t> _count;
+		std::atomic<uint64_t> _totalNs;
+	};
 
-		template<typename T>
-		struct ValueUnboxer<std::vector<T>>
+	struct CallStatsEntry
+	{
+		explicit CallStatsEntry(const std::string& functionName)
+			: _functionName(functionName), _bytesToJulia(0), _bytesFromJulia(0), _gcAllocatedBytes(0), _gcCollections(0), _callsWithGc(0), _gcPauseNs(0)
 		{
-			typedef std::vector<T> type;
+		}
 
-			static type apply(jl_value_t* val)
-			{
-				JULIACPP_ASSERT(jl_is_array(val), "Unboxing std::vector: jl_value_t is not an array.");
-				std::vector<T> array;
-				array.resize(jl_array_len(val));
+		const std::string _functionName;
+		PhaseHistogram _phases[4];
+		std::atomic<uint64_t> _bytesToJulia;
+		std::atomic<uint64_t> _bytesFromJulia;
+		std::atomic<uint64_t> _gcAllocatedBytes;
+		std::atomic<uint64_t> _gcCollections;
+		std::atomic<uint64_t> _callsWithGc;
+		std::atomic<uint64_t> _gcPauseNs;
+	};
 
-				unboxArray<std::vector<T>, T>(val, array);
-				return array;
-			}
-		};
+	class CallStatsRegistry
+	{
+	public:
+		static CallStatsRegistry& instance()
+		{
+			static CallStatsRegistry registry;
+			return registry;
+		}
 
-		template<typename T>
-		struct ValueUnboxer<ArrayPointer<T>>
+		// Entries are never removed, so the returned pointer stays valid
+		CallStatsEntry* entry(const std::string& functionName)
 		{
-			typedef ArrayPointer<T> type;
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto& entry = _entries[functionName];
+			if (!entry)
+				entry.reset(new CallStatsEntry(functionName));
+			return entry.get();
+		}
 
-			static type apply(jl_value_t* val)
-			{
-				JULIACPP_ASSERT(jl_is_array(val), "Unboxing ArrayPointer: jl_value_t is not an array.");
-				const auto len = jl_array_len(val);
-				ArrayPointer<T> array(new T[len], len);
+		template <typename F>
+		void forEach(F&& f)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			for (auto& kv : _entries)
+				f(*kv.second);
+		}
 
-				unboxArray<ArrayPointer<T>, T>(val, array);
-				return array;
-			}
-		};
-	} // namespace Unboxer
+	private:
+		std::mutex _mutex;
+		std::map<std::string, std::unique_ptr<CallStatsEntry>> _entries;
+	};
 
-	namespace RefUnboxer
+	// Bytes copied across the boundary by the current thread
+	struct CopiedBytes
 	{
-		template <typename TArray, typename T>
-		static void unboxArrayByRef(jl_value_t* val, TArray& array);
+		uint64_t _toJulia;
+		uint64_t _fromJulia;
+	};
 
-		template<typename... TReturns>
-		struct RefValueUnboxer
+	// Mirror of Julia's internal jl_gc_num_t (src/gc.h), which the exported
+	// jl_gc_num() returns. Base.GC_Num is kept in sync with it by Julia, so
+	// hasGcNum() compares the two before the mirror is read.
+	struct GcNum
+	{
+		int64_t _allocd;
+		int64_t _deferredAlloc;
+		int64_t _freed;
+		uint64_t _malloc;
+		uint64_t _realloc;
+		uint64_t _poolalloc;
+		uint64_t _bigalloc;
+		uint64_t _freecall;
+		uint64_t _totalTime;
+		uint64_t _totalAllocd;
+		uint64_t _sinceSweep;
+		size_t _interval;
+		int _pause; // number of collections
+		int _fullSweep;
+	};
+
+	extern "C" GcNum jl_gc_num(void);
+
+	// Whether GcNum matches the layout of this Julia version, checked once
+	inline bool hasGcNum()
+	{
+		static const bool matches = []()
 		{
-			template <typename T>
-			static void unboxAt(jl_value_t* value, size_t index, T& outVal)
-			{
-				log("unboxing tuple at index %d", (int)index);
-				RefValueUnboxer<T>::apply(jl_fieldref(value, index), outVal);
-			}
+			jl_datatype_t* type = (jl_datatype_t*)jl_get_global(jl_base_module, JULIACPP_SYMBOL("GC_Num"));
+			if (type == nullptr || !jl_is_datatype(type) || jl_datatype_size(type) != sizeof(GcNum))
+				return false;
+
+			const size_t pause = 12;
+			return jl_datatype_nfields(type) > pause && jl_field_name(type, pause) == JULIACPP_SYMBOL("pause")
+				&& jl_field_offset(type, (int)pause) == offsetof(GcNum, _pause);
+		}();
+		return matches;
+	}
 
-			template <typename T>
-			static void rec(jl_value_t* value, size_t idx, T& outVal)
-			{
-				unboxAt(value, idx, outVal);
-			}
+#ifdef JULIACPP_ENABLE_CALL_STATS
+	inline CopiedBytes& copiedBytes()
+	{
+		static thread_local CopiedBytes bytes { 0, 0 };
+		return bytes;
+	}
 
-			template<typename T, typename... TArgs>
-			static void rec(jl_value_t* value, size_t idx, T& outVal, TArgs&... outVals)
+	inline void countBytesToJulia(size_t bytes) { copiedBytes()._toJulia += bytes; }
+	inline void countBytesFromJulia(size_t bytes) { copiedBytes()._fromJulia += bytes; }
+
+	// Adds the duration of its scope and the bytes copied meanwhile to a
+	// phase of stats. Does nothing if stats is null.
+	class PhaseTimer
+	{
+	public:
+		PhaseTimer(CallStatsEntry* stats, CallPhase phase)
+			: _stats(stats), _phase(phase)
+		{
+			if (_stats != nullptr)
 			{
-				rec(value, idx, outVal);
-				rec(value, idx+1, outVals...);
+				_bytes = copiedBytes();
+				_start = std::chrono::steady_clock::now();
 			}
+		}
 
-			template<std::size_t... N>
-			static void unboxTuple(jl_value_t* value, std::tuple<TReturns&...>& tuple, Indices<N...>)
+		~PhaseTimer()
+		{
+			if (_stats == nullptr)
+				return;
+
+			const auto end = std::chrono::steady_clock::now();
+			const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - _start).count();
+			_stats->_phases[(size_t)_phase].record((uint64_t)ns);
+
+			if (TraceRecorder::instance().isRecording())
 			{
-				rec<TReturns...>(value, 0, std::get<N>(tuple)...);
+				static const char* names[] = { "box", "dispatch", "exception", "unbox" };
+				TraceRecorder::instance().record("phase", names[(size_t)_phase], _start, end, "\"function\":" + jsonString(_stats->_functionName));
 			}
 
-			static void apply(jl_value_t* value, std::tuple<TReturns&...>& tuple)
-			{
-				constexpr auto numReturns = sizeof...(TReturns);
-				static_assert(numReturns > 1, "This function call is for tuples.");
+			const CopiedBytes& bytes = copiedBytes();
+			if (bytes._toJulia != _bytes._toJulia)
+				_stats->_bytesToJulia.fetch_add(bytes._toJulia - _bytes._toJulia, std::memory_order_relaxed);
+			if (bytes._fromJulia != _bytes._fromJulia)
+				_stats->_bytesFromJulia.fetch_add(bytes._fromJulia - _bytes._fromJulia, std::memory_order_relaxed);
+		}
 
-				JULIACPP_ASSERT(jl_is_tuple(value), "Returned value is not a tuple.");
-				JULIACPP_ASSERT(jl_nfields(value) == numReturns, "Julia did not return the expected number of values.");
+		PhaseTimer(const PhaseTimer&) = delete;
+		PhaseTimer& operator=(const PhaseTimer&) = delete;
 
-				unboxTuple(value, tuple, typename IndicesBuilder<numReturns>::type());
-			}
-		};
+	private:
+		CallStatsEntry* _stats;
+		CallPhase _phase;
+		CopiedBytes _bytes;
+		std::chrono::steady_clock::time_point _start;
+	};
 
-		template<typename T>
-		struct RefValueUnboxer<T>
+	// The "call" span from boxing the arguments to checking for exceptions
+	class CallSpan
+	{
+	public:
+		CallSpan(CallStatsEntry* stats)
+			: _stats(stats), _active(stats != nullptr && TraceRecorder::instance().isRecording()), _arguments(0)
 		{
-			static void apply(jl_value_t* value, T& outVal)
+			if (_active)
 			{
-				outVal = unbox<T>(value);
+				_bytesToJulia = copiedBytes()._toJulia;
+				_start = std::chrono::steady_clock::now();
 			}
-		};
+		}
 
-		template<typename T, size_t N>
-		struct RefValueUnboxer<std::array<T, N>>
+		~CallSpan()
 		{
-			typedef std::array<T, N> type;
+			if (!_active)
+				return;
 
-			static void apply(jl_value_t* val, type& outArray)
-			{
-				unboxArrayByRef<std::array<T, N>, T>(val, outArray);
-			}
-		};
+			std::ostringstream args;
+			args << "\"arguments\":" << _arguments << ",\"bytesToJulia\":" << copiedBytes()._toJulia - _bytesToJulia;
+			TraceRecorder::instance().record("call", _stats->_functionName, _start, std::chrono::steady_clock::now(), args.str());
+		}
 
-		template<typename T>
-		struct RefValueUnboxer<std::vector<T>>
-		{
-			typedef std::vector<T> type;
+		void setArguments(size_t arguments) { _arguments = arguments; }
 
-			static void apply(jl_value_t* val, type& outArray)
-			{
-				unboxArrayByRef<std::vector<T>, T>(val, outArray);
-			}
-		};
+		CallSpan(const CallSpan&) = delete;
+		CallSpan& operator=(const CallSpan&) = delete;
 
-		template<typename T>
-		struct RefValueUnboxer<ArrayPointer<T>>
+	private:
+		CallStatsEntry* _stats;
+		bool _active;
+		size_t _arguments;
+		uint64_t _bytesToJulia;
+		std::chrono::steady_clock::time_point _start;
+	};
+
+	// Marks the first call of a function, which includes compiling it for the
+	// argument types. Julia 0.6 has no JIT timer to tell the two apart.
+	class FirstCallSpan
+	{
+	public:
+		FirstCallSpan(CallStatsEntry* stats, bool firstCall)
+			: _stats(stats), _active(firstCall && stats != nullptr && TraceRecorder::instance().isRecording())
 		{
-			typedef ArrayPointer<T> type;
+			if (_active)
+				_start = std::chrono::steady_clock::now();
+		}
 
-			static void apply(jl_value_t* val, type& outArray)
-			{
-				unboxArrayByRef<ArrayPointer<T>, T>(val, outArray);
-			}
-		};
+		~FirstCallSpan()
+		{
+			if (_active)
+				TraceRecorder::instance().record("first-call", _stats->_functionName, _start, std::chrono::steady_clock::now());
+		}
 
-		template<typename T, size_t N>
-		struct RefValueUnboxer<T[N]>
+		FirstCallSpan(const FirstCallSpan&) = delete;
+		FirstCallSpan& operator=(const FirstCallSpan&) = delete;
+
+	private:
+		CallStatsEntry* _stats;
+		bool _active;
+		std::chrono::steady_clock::time_point _start;
+	};
+
+	// Julia GC counters before a call. They are process-wide, so allocations
+	// and collections of other threads running Julia code at the same time
+	// are included.
+	struct GcSnapshot
+	{
+		int64_t _allocatedBytes;
+		uint64_t _pauseNs;
+		int _collections; // 0 without hasGcNum()
+	};
+
+	inline GcSnapshot gcSnapshot(CallStatsEntry* stats)
+	{
+		if (stats == nullptr)
+			return GcSnapshot { 0, 0, 0 };
+		return GcSnapshot { jl_gc_total_bytes(), jl_gc_total_hrtime(), hasGcNum() ? jl_gc_num()._pause : 0 };
+	}
+
+	inline void recordGc(CallStatsEntry* stats, const GcSnapshot& before)
+	{
+		if (stats == nullptr)
+			return;
+
+		const int64_t allocatedBytes = jl_gc_total_bytes() - before._allocatedBytes;
+		const uint64_t pauseNs = jl_gc_total_hrtime() - before._pauseNs;
+		const int collections = hasGcNum() ? jl_gc_num()._pause - before._collections : 0;
+		if (allocatedBytes > 0)
+			stats->_gcAllocatedBytes.fetch_add((uint64_t)allocatedBytes, std::memory_order_relaxed);
+		if (collections > 0)
+			stats->_gcCollections.fetch_add((uint64_t)collections, std::memory_order_relaxed);
+		if (pauseNs > 0)
 		{
-			static void apply(jl_value_t* val, T(& outArray)[N])
+			stats->_callsWithGc.fetch_add(1, std::memory_order_relaxed);
+			stats->_gcPauseNs.fetch_add(pauseNs, std::memory_order_relaxed);
+
+			// The pause position within the call is unknown, it is shown at the end
+			if (TraceRecorder::instance().isRecording())
 			{
-				ArrayPointer<T> a(outArray);
-				unboxArrayByRef<ArrayPointer<T>, T>(val, a);
+				const auto end = std::chrono::steady_clock::now();
+				TraceRecorder::instance().record("gc", "GC pause", end - std::chrono::nanoseconds(pauseNs), end, "\"function\":" + jsonString(stats->_functionName));
 			}
-		};
-
-		template <typename TArray, typename TElem>
-		static void unboxArrayByRef(jl_value_t* val, TArray& array)
-		{
-			static_assert(!std::is_const<TElem>::value, "Cannot unbox array of const type.");
-			JULIACPP_ASSERT(jl_is_array(val), "jl_value_t is not an array.");
+		}
+	}
+#else
+	inline void countBytesToJulia(size_t) { }
+	inline void countBytesFromJulia(size_t) { }
 
-			jl_array_t* jlArray = (jl_array_t*)val;
+	struct PhaseTimer
+	{
+		PhaseTimer(CallStatsEntry*, CallPhase) { }
+	};
+
+	struct CallSpan
+	{
+		CallSpan(CallStatsEntry*) { }
+		void setArguments(size_t) { }
+	};
+
+	struct FirstCallSpan
+	{
+		FirstCallSpan(CallStatsEntry*, bool) { }
+	};
+
+	struct GcSnapshot { };
+	inline GcSnapshot gcSnapshot(CallStatsEntry*) { return GcSnapshot(); }
+	inline void recordGc(CallStatsEntry*, const GcSnapshot&) { }
+#endif
+
+	inline jl_datatype_t* bitVectorType()
+	{
+		static jl_datatype_t* type = nullptr;
+		if (type == nullptr)
+			type = (jl_datatype_t*)jl_get_global(jl_base_module, JULIACPP_SYMBOL("BitVector"));
+		return type;
+	}
+
+	// std::vector<bool> and Julia's BitVector chunks both store element
+	// 64 * k + i in bit i of word k. With libstdc++ the words are accessible
+	// directly, otherwise bits are packed and unpacked one word at a time.
+	inline size_t numBitChunks(size_t len) { return (len + 63) / 64; }
+
+#if defined(__GLIBCXX__)
+	inline void* bitWords(std::vector<bool>& bits) { return sizeof(*bits.begin()._M_p) == sizeof(uint64_t) ? bits.begin()._M_p : nullptr; }
+	inline const void* bitWords(const std::vector<bool>& bits) { return sizeof(*bits.begin()._M_p) == sizeof(uint64_t) ? bits.begin()._M_p : nullptr; }
+#else
+	inline void* bitWords(std::vector<bool>&) { return nullptr; }
+	inline const void* bitWords(const std::vector<bool>&) { return nullptr; }
+#endif
+
+	inline void packBits(const std::vector<bool>& bits, uint64_t* chunks)
+	{
+		const size_t len = bits.size();
+		const size_t numChunks = numBitChunks(len);
+		if (numChunks == 0)
+			return;
+
+		countBytesToJulia(numChunks * sizeof(uint64_t));
+		const void* words = bitWords(bits);
+		if (words != nullptr)
+		{
+			std::memcpy(chunks, words, numChunks * sizeof(uint64_t));
+		}
+		else
+		{
+			for (size_t c = 0; c < numChunks; c++)
+			{
+				const size_t end = std::min(len, (c + 1) * 64);
+				uint64_t word = 0;
+				for (size_t i = c * 64; i < end; i++)
+					word |= (uint64_t)bits[i] << (i % 64);
+				chunks[c] = word;
+			}
+		}
+
+		// BitVector requires the unused bits of the last chunk to be zero
+		if (len % 64 != 0)
+			chunks[numChunks - 1] &= ~(uint64_t)0 >> (64 - len % 64);
+	}
+
+	inline void unpackBits(const uint64_t* chunks, size_t len, std::vector<bool>& bits)
+	{
+		bits.resize(len);
+		const size_t numChunks = numBitChunks(len);
+		if (numChunks == 0)
+			return;
+
+		countBytesFromJulia(numChunks * sizeof(uint64_t));
+		void* words = bitWords(bits);
+		if (words != nullptr)
+		{
+			std::memcpy(words, chunks, numChunks * sizeof(uint64_t));
+		}
+		else
+		{
+			for (size_t i = 0; i < len; i++)
+				bits[i] = (chunks[i / 64] >> (i % 64)) & 1;
+		}
+	}
+
+	inline void unpackBytes(const uint8_t* bytes, size_t len, std::vector<bool>& bits)
+	{
+		bits.resize(len);
+		void* words = bitWords(bits);
+		if (words == nullptr)
+		{
+			for (size_t i = 0; i < len; i++)
+				bits[i] = bytes[i] != 0;
+			return;
+		}
+
+		for (size_t c = 0; c < numBitChunks(len); c++)
+		{
+			const size_t n = std::min<size_t>(64, len - c * 64);
+			uint64_t word = 0;
+			for (size_t i = 0; i < n; i++)
+				word |= (uint64_t)(bytes[c * 64 + i] != 0) << i;
+			std::memcpy((uint64_t*)words + c, &word, sizeof(uint64_t));
+		}
+	}
+
+	template <typename T> inline jl_datatype_t* dataTypeOf()
+	{
+		static_assert(sizeof(T) == -1, "No jl_datatype_t found.");
+		return nullptr;
+	}
+
+	template <> inline jl_datatype_t* dataTypeOf<bool>() { return jl_bool_type; }
+	template <> inline jl_datatype_t* dataTypeOf<char>() { return jl_char_type; }
+	template <> inline jl_datatype_t* dataTypeOf<int8_t>() { return jl_int8_type; }
+	template <> inline jl_datatype_t* dataTypeOf<int16_t>() { return jl_int16_type; }
+	template <> inline jl_datatype_t* dataTypeOf<int32_t>() { return jl_int32_type; }
+	template <> inline jl_datatype_t* dataTypeOf<int64_t>() { return jl_int64_type; }
+	template <> inline jl_datatype_t* dataTypeOf<uint8_t>() { return jl_uint8_type; }
+	template <> inline jl_datatype_t* dataTypeOf<uint16_t>() { return jl_uint16_type; }
+	template <> inline jl_datatype_t* dataTypeOf<uint32_t>() { return jl_uint32_type; }
+	template <> inline jl_datatype_t* dataTypeOf<uint64_t>() { return jl_uint64_type; }
+	template <> inline jl_datatype_t* dataTypeOf<float>() { return jl_float32_type; }
+	template <> inline jl_datatype_t* dataTypeOf<double>() { return jl_float64_type; }
+	template <> inline jl_datatype_t* dataTypeOf<std::string>() { return jl_string_type; }
+	template <> inline jl_datatype_t* dataTypeOf<const char*>() { return jl_string_type; }
+	template <> inline jl_datatype_t* dataTypeOf<Float16>() { return jl_float16_type; }
+
+	template <typename T>
+	inline jl_datatype_t* complexTypeOf()
+	{
+		static jl_datatype_t* type = nullptr;
+		if (type == nullptr)
+		{
+			jl_value_t* complex = jl_get_global(jl_base_module, JULIACPP_SYMBOL("Complex"));
+			type = (jl_datatype_t*)jl_apply_type1(complex, (jl_value_t*)dataTypeOf<T>());
+		}
+		return type;
+	}
+
+	template <> inline jl_datatype_t* dataTypeOf<std::complex<float>>() { return complexTypeOf<float>(); }
+	template <> inline jl_datatype_t* dataTypeOf<std::complex<double>>() { return complexTypeOf<double>(); }
+
+
+	template<typename T>
+	struct TypeTraits
+	{
+		static constexpr bool isPtrArray = false;
+		static inline jl_datatype_t* dataType() { return dataTypeOf<UnqualifiedType<T>>(); }
+	};
+
+	template<>
+	struct TypeTraits<std::string>
+	{
+		static constexpr bool isPtrArray = true;
+		static inline jl_datatype_t* dataType() { return dataTypeOf<std::string>(); }
+	};
+
+	template<>
+	struct TypeTraits<const char*>
+	{
+		static constexpr bool isPtrArray = true;
+		static jl_datatype_t* dataType() { return dataTypeOf<const char*>(); }
+	};
+
+	template<typename T, size_t size>
+	struct TypeTraits<T[size]>
+	{
+		static constexpr bool isPtrArray = true;
+		static jl_datatype_t* dataType() { return jl_array_type; }
+	};
+
+	template<typename T>
+	struct TypeTraits<ArrayPointer<T>>
+	{
+		static constexpr bool isPtrArray = true;
+		static jl_datatype_t* dataType() { return jl_array_type; }
+	};
+
+	template<typename T, size_t N>
+	struct TypeTraits<std::array<T, N>>
+	{
+		static constexpr bool isPtrArray = true;
+		static jl_datatype_t* dataType() { return jl_array_type; }
+	};
+
+	template<typename T>
+	struct TypeTraits<std::vector<T>>
+	{
+		static constexpr bool isPtrArray = true;
+		static jl_datatype_t* dataType() { return jl_array_type; }
+	};
+
+	// Boxed as BitVector, see box(const std::vector<bool>&)
+	template<>
+	struct TypeTraits<std::vector<bool>>
+	{
+		static constexpr bool isPtrArray = true;
+		static jl_datatype_t* dataType() { return bitVectorType(); }
+	};
+
+	template<typename T>
+	struct TypeTraits<RaggedArray<T>>
+	{
+		static constexpr bool isPtrArray = true;
+		static jl_datatype_t* dataType() { return jl_array_type; }
+	};
+
+
+	template <typename T>
+	using ValueIfPtrArray = typename std::enable_if<TypeTraits<UnqualifiedType<T>>::isPtrArray, jl_value_t*>::type;
+	template <typename T>
+	using ValueIfNotPtrArray = typename std::enable_if<!TypeTraits<UnqualifiedType<T>>::isPtrArray, jl_value_t*>::type;
+
+
+	inline jl_value_t* box(bool val) { return jl_box_bool(val); }
+	inline jl_value_t* box(char val) { return jl_box_char((uint32_t)val); }
+	inline jl_value_t* box(int8_t val) { return jl_box_int8(val); }
+	inline jl_value_t* box(int16_t val) { return jl_box_int16(val); }
+	inline jl_value_t* box(int32_t val) { return jl_box_int32(val); }
+	inline jl_value_t* box(int64_t val) { return jl_box_int64(val); }
+	inline jl_value_t* box(uint8_t val) { return jl_box_uint8(val); }
+	inline jl_value_t* box(uint16_t val) { return jl_box_uint16(val); }
+	inline jl_value_t* box(uint32_t val) { return jl_box_uint32(val); }
+	inline jl_value_t* box(uint64_t val) { return jl_box_uint64(val); }
+	inline jl_value_t* box(float val) { return jl_box_float32(val); }
+	inline jl_value_t* box(double val) { return jl_box_float64(val); }
+	// Encoding for individual strings is handled by Julia. Julia strings are immutable.
+	inline jl_value_t* box(const std::string& val) { countBytesToJulia(val.size()); return jl_cstr_to_string(val.c_str()); }
+	inline jl_value_t* box(const char* val) { countBytesToJulia(std::strlen(val)); return jl_cstr_to_string(val); }
+	// Bits types without a jl_box_* function
+	inline jl_value_t* box(Float16 val) { return jl_new_bits((jl_value_t*)jl_float16_type, &val._bits); }
+	inline jl_value_t* box(std::complex<float> val) { return jl_new_bits((jl_value_t*)dataTypeOf<std::complex<float>>(), &val); }
+	inline jl_value_t* box(std::complex<double> val) { return jl_new_bits((jl_value_t*)dataTypeOf<std::complex<double>>(), &val); }
+
+	template<typename T> ValueIfNotPtrArray<T> boxArray(T* data, size_t size);
+	template<typename T> ValueIfNotPtrArray<T> boxArray(const T* data, size_t size);
+	template<typename T> ValueIfPtrArray<T> boxArray(T* data, size_t size);
+	template<typename T> ValueIfPtrArray<T> boxArray(const T* data, size_t size);
+
+	template<typename T, size_t N>
+	inline jl_value_t* box(T(& val)[N]) { return boxArray<T>(val, N); }
+
+	template<typename T>
+	inline jl_value_t* box(ArrayPointer<T>& val) { return boxArray<T>(val._data, val._len); }
+
+	template<typename T, size_t N>
+	inline jl_value_t* box(std::array<T, N>& val) { return boxArray<T>(val.data(), val.size()); }
+
+	template<typename T, size_t N>
+	inline jl_value_t* box(const std::array<T, N>& val) { return boxArray<T>(val.data(), val.size()); }
+
+	template<typename T>
+	inline jl_value_t* box(std::vector<T>& val) { return boxArray<T>(val.data(), val.size()); }
+
+	template<typename T>
+	inline jl_value_t* box(const std::vector<T>& val) { return boxArray<T>(val.data(), val.size()); }
+
+	template<typename TValues, typename TOffsets>
+	jl_value_t* boxRaggedArray(TValues* values, TOffsets* offsets, size_t size);
+
+	template<typename T>
+	inline jl_value_t* box(RaggedArray<T>& val) { return boxRaggedArray(val._values.data(), val._offsets.data(), val._offsets.size()); }
+
+	template<typename T>
+	inline jl_value_t* box(const RaggedArray<T>& val) { return boxRaggedArray(val._values.data(), val._offsets.data(), val._offsets.size()); }
+
+	// std::vector<bool> has no data(), it is always copied into a BitVector
+	inline jl_value_t* box(const std::vector<bool>& val)
+	{
+		log("box(std::vector<bool>) - packing into BitVector chunks");
+
+		jl_value_t* chunks = nullptr;
+		jl_value_t* len = nullptr;
+		JL_GC_PUSH2(&chunks, &len);
+
+		chunks = (jl_value_t*)jl_alloc_array_1d(jl_apply_array_type(jl_uint64_type, 1), numBitChunks(val.size()));
+		packBits(val, (uint64_t*)jl_array_data(chunks));
+		len = jl_box_int64((int64_t)val.size());
+		jl_value_t* bits = jl_call2(JULIACPP_HELPER("bitVectorFromChunks"), chunks, len);
+
+		JL_GC_POP();
+
+		JULIACPP_ASSERT(bits != nullptr && jl_exception_occurred() == nullptr, "Could not create BitVector.");
+		return bits;
+	}
+
+	inline jl_value_t* box(std::vector<bool>& val) { return box((const std::vector<bool>&)val); }
+
+	template<typename T>
+	ValueIfNotPtrArray<T> boxArray(T* data, size_t size)
+	{
+		log("boxArray(T*) - jl_ptr_to_array_1d");
+
+		jl_datatype_t* dataType = TypeTraits<UnqualifiedType<T>>::dataType();
+		JULIACPP_ASSERT(dataType != nullptr, "Data type not supported.");
+
+		jl_value_t* arrayType = jl_apply_array_type(dataType, 1);
+		jl_array_t* array = jl_ptr_to_array_1d(arrayType, data, size, 0);
+
+		return (jl_value_t*)array;
+	}
+
+	template<typename T>
+	ValueIfNotPtrArray<T> boxArray(const T* data, size_t size)
+	{
+		log("boxArray(const T*) - jl_alloc_array_1d and memcpy");
+
+		jl_datatype_t* dataType = TypeTraits<UnqualifiedType<T>>::dataType();
+		JULIACPP_ASSERT(dataType != nullptr, "Data type not supported.");
+
+		jl_value_t* arrayType = jl_apply_array_type(dataType, 1);
+		jl_array_t* array = jl_alloc_array_1d(arrayType, size);
+
+		std::memcpy(jl_array_data(array), data, sizeof(T) * size);
+		countBytesToJulia(sizeof(T) * size);
+
+		return (jl_value_t*)array;
+	}
+
+	template<typename T>
+	ValueIfPtrArray<T> boxArray(T* data, size_t size)
+	{
+		log("boxArray(T*) - jl_alloc_array_1d and unbox per element");
+
+		jl_datatype_t* dataType = TypeTraits<UnqualifiedType<T>>::dataType();
+		JULIACPP_ASSERT(dataType != nullptr, "Data type not supported.");
+
+		jl_value_t* arrayType = jl_apply_array_type(dataType, 1);
+
+		jl_array_t* array = jl_alloc_array_1d(arrayType, size);
+		jl_value_t** arrayData = (jl_value_t**)jl_array_data(array);
+		for (size_t i = 0; i < size; i++)
+		{
+			arrayData[i] = box(data[i]);
+		}
+
+		return (jl_value_t*)array;
+	}
+
+	template<typename T>
+	ValueIfPtrArray<T> boxArray(const T* data, size_t size)
+	{
+		log("boxArray(const T*) - jl_alloc_array_1d and unbox per element");
+
+		jl_datatype_t* dataType = TypeTraits<UnqualifiedType<T>>::dataType();
+		JULIACPP_ASSERT(dataType != nullptr, "Data type not supported.");
+
+		jl_value_t* arrayType = jl_apply_array_type(dataType, 1);
+
+		jl_array_t* array = jl_alloc_array_1d(arrayType, size);
+		jl_value_t** arrayData = (jl_value_t**)jl_array_data(array);
+		for (size_t i = 0; i < size; i++)
+		{
+			arrayData[i] = box(data[i]);
+		}
+
+		return (jl_value_t*)array;
+	}
+
+
+	template<typename TValues, typename TOffsets>
+	jl_value_t* boxRaggedArray(TValues* values, TOffsets* offsets, size_t numOffsets)
+	{
+		log("boxRaggedArray - values and offsets as two arrays, views created in Julia");
+
+		JULIACPP_ASSERT(numOffsets > 0 && offsets[0] == 0, "RaggedArray offsets must start with 0.");
+
+		jl_value_t* jlValues = nullptr;
+		jl_value_t* jlOffsets = nullptr;
+		JL_GC_PUSH2(&jlValues, &jlOffsets);
+
+		jlValues = boxArray<TValues>(values, (size_t)offsets[numOffsets - 1]);
+		jlOffsets = boxArray<TOffsets>(offsets, numOffsets);
+		jl_value_t* views = jl_call2(JULIACPP_HELPER("raggedViews"), jlValues, jlOffsets);
+
+		JL_GC_POP();
+
+		JULIACPP_ASSERT(views != nullptr && jl_exception_occurred() == nullptr, "Could not create RaggedArray views.");
+		return views;
+	}
+
+
+	template<typename T>
+	static T unbox(jl_value_t*)
+	{
+		static_assert(sizeof(T) == -1, "No jl_value_t* unbox for type.");
+	}
+
+	template <> inline void unbox<void>(jl_value_t*) { }
+	template <> inline bool unbox<bool>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_bool(val)); return (bool)jl_unbox_bool(val); }
+	template <> inline int8_t unbox<int8_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_int8(val)); return jl_unbox_int8(val); }
+	template <> inline int16_t unbox<int16_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_int16(val)); return jl_unbox_int16(val); }
+	template <> inline int32_t unbox<int32_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_int32(val)); return jl_unbox_int32(val); }
+	template <> inline int64_t unbox<int64_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_int64(val)); return jl_unbox_int64(val); }
+	template <> inline uint8_t unbox<uint8_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_uint8(val)); return jl_unbox_uint8(val); }
+	template <> inline uint16_t unbox<uint16_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_uint16(val)); return jl_unbox_uint16(val); }
+	template <> inline uint32_t unbox<uint32_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_uint32(val)); return jl_unbox_uint32(val); }
+	template <> inline uint64_t unbox<uint64_t>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_uint64(val)); return jl_unbox_uint64(val); }
+	template <> inline float unbox<float>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_float32(val)); return jl_unbox_float32(val); }
+	template <> inline double unbox<double>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_float64(val)); return jl_unbox_float64(val); }
+	template <> inline std::string unbox<std::string>(jl_value_t* val) { JULIACPP_ASSERT_NOMSG(jl_is_string(val)); countBytesFromJulia(jl_string_len(val)); return std::string(jl_string_data(val)); }
+
+	template <typename T>
+	inline T unboxBits(jl_value_t* val)
+	{
+		JULIACPP_ASSERT(jl_typeis(val, dataTypeOf<T>()), "Unexpected jl_value_t type.");
+		T result;
+		std::memcpy(&result, jl_data_ptr(val), sizeof(T));
+		return result;
+	}
+
+	template <> inline Float16 unbox<Float16>(jl_value_t* val) { return unboxBits<Float16>(val); }
+	template <> inline std::complex<float> unbox<std::complex<float>>(jl_value_t* val) { return unboxBits<std::complex<float>>(val); }
+	template <> inline std::complex<double> unbox<std::complex<double>>(jl_value_t* val) { return unboxBits<std::complex<double>>(val); }
+	// Disabled for now, can be garbage collected by Julia
+	//template <> inline const char* unbox<const char*>(jl_value_t* val) { return jl_string_data(val); }
+
+	// Elements of Array{Any} results that were unboxed by the bulk fast path
+	// and one at a time. Exposed through getUnboxStats().
+	struct UnboxCounters
+	{
+		std::atomic<size_t> fastPathElements;
+		std::atomic<size_t> slowPathElements;
+	};
+
+	inline UnboxCounters& unboxCounters()
+	{
+		static UnboxCounters counters;
+		return counters;
+	}
+
+	// If all elements of an Array{Any} are boxed values of TElem's bits type,
+	// copy them with a single type scan instead of unboxing each element.
+	template <typename TArray, typename TElem>
+	inline bool unboxHomogeneousPtrArray(jl_value_t** data, TArray& array, size_t size, std::true_type)
+	{
+		jl_datatype_t* dataType = TypeTraits<TElem>::dataType();
+		if (jl_datatype_size(dataType) != sizeof(TElem))
+			return false;
+
+		bool homogeneous = true;
+		for (size_t i = 0; i < size; i++)
+			homogeneous &= data[i] != nullptr && jl_typeis(data[i], dataType);
+
+		if (!homogeneous)
+			return false;
+
+		for (size_t i = 0; i < size; i++)
+			std::memcpy(&array[i], jl_data_ptr(data[i]), sizeof(TElem));
+		countBytesFromJulia(sizeof(TElem) * size);
+
+		unboxCounters().fastPathElements.fetch_add(size, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Nested arrays and strings are always unboxed per element
+	template <typename TArray, typename TElem>
+	inline bool unboxHomogeneousPtrArray(jl_value_t**, TArray&, size_t, std::false_type)
+	{
+		return false;
+	}
+
+	template <typename TArray, typename TElem>
+	inline bool unboxHomogeneousPtrArray(jl_value_t** data, TArray& array, size_t size)
+	{
+		return unboxHomogeneousPtrArray<TArray, TElem>(data, array, size, std::integral_constant<bool, !TypeTraits<TElem>::isPtrArray>());
+	}
+
+	namespace Unboxer
+	{
+		template<typename... TReturns>
+		struct ValueUnboxer
+		{
+			typedef std::tuple<TReturns...> type;
+
+			template <typename T>
+			static T unboxAt(jl_value_t* value, size_t index)
+			{
+				log("unboxing tuple at index %d", (int)index);
+				return ValueUnboxer<T>::apply(jl_fieldref(value, index));
+			}
+
+			template <typename... T, std::size_t... N>
+			static std::tuple<T...> makeTuple(jl_value_t* value, Indices<N...>)
+			{
+				return std::make_tuple(unboxAt<T>(value, N)...);
+			}
+
+			static type apply(jl_value_t* value)
+			{
+				constexpr auto numReturns = sizeof...(TReturns);
+				static_assert(numReturns > 1, "This function call is for tuples.");
+
+				JULIACPP_ASSERT(jl_is_tuple(value), "Returned value is not a tuple.");
+				JULIACPP_ASSERT(jl_nfields(value) == numReturns, "Julia did not return the expected number of values.")
+
+				return makeTuple<TReturns...>(value, typename IndicesBuilder<numReturns>::type());
+			}
+		};
+
+		template <typename TArray, typename TElem>
+		static void unboxArray(jl_value_t* val, TArray& array)
+		{
+			static_assert(!std::is_const<TElem>::value, "Cannot unbox array of const type.");
+			JULIACPP_ASSERT(jl_is_array(val), "jl_value_t is not an array.");
+
+			jl_array_t* jlArray = (jl_array_t*)val;
+
+			const auto size = array.size();
+			JULIACPP_ASSERT(jlArray->length == size, "Invalid array length.");
+			if (jlArray->flags.ptrarray)
+			{
+				jl_value_t** data = (jl_value_t**)jlArray->data;
+				if (unboxHomogeneousPtrArray<TArray, TElem>(data, array, size))
+					return;
+
+				unboxCounters().slowPathElements.fetch_add(size, std::memory_order_relaxed);
+				for (size_t i = 0; i < size; i++)
+				{
+					array[i] = ValueUnboxer<TElem>::apply(data[i]);
+				}
+			}
+			else
+			{
+				JULIACPP_ASSERT(jl_array_eltype(val) == TypeTraits<TElem>::dataType(), "Unexpected jl_array_t element type.");
+				std::memcpy(array.data(), jlArray->data, sizeof(TElem) * size);
+				countBytesFromJulia(sizeof(TElem) * size);
+			}
+		}
+
+		template<>
+		struct ValueUnboxer<>
+		{
+		};
+
+		template<typename T>
+		struct ValueUnboxer<T>
+		{
+			typedef T type;
+
+			static type apply(jl_value_t* value)
+			{
+				return unbox<T>(value);
+			}
+		};
+
+		template<typename T, size_t N>
+		struct ValueUnboxer<std::array<T, N>>
+		{
+			typedef std::array<T, N> type;
+
+			static type apply(jl_value_t* val)
+			{
+				std::array<T, N> array;
+				unboxArray<std::array<T, N>, T>(val, array);
+				return array;
+			}
+		};
+
+		template<typename T>
+		struct ValueUnboxer<std::vector<T>>
+		{
+			typedef std::vector<T> type;
+
+			static type apply(jl_value_t* val)
+			{
+				JULIACPP_ASSERT(jl_is_array(val), "Unboxing std::vector: jl_value_t is not an array.");
+				std::vector<T> array;
+				array.resize(jl_array_len(val));
+
+				unboxArray<std::vector<T>, T>(val, array);
+				return array;
+			}
+		};
+
+		// Accepts both BitVector and Vector{Bool}
+		inline void unboxBoolArray(jl_value_t* val, std::vector<bool>& array)
+		{
+			if (jl_typeis(val, bitVectorType()))
+			{
+				log("unboxBoolArray - BitVector chunks");
+				jl_value_t* chunks = jl_get_field(val, "chunks");
+				unpackBits((const uint64_t*)jl_array_data(chunks), (size_t)jl_unbox_int64(jl_get_field(val, "len")), array);
+			}
+			else
+			{
+				JULIACPP_ASSERT(jl_is_array(val), "Unboxing std::vector<bool>: jl_value_t is neither a BitVector nor an array.");
+				JULIACPP_ASSERT(jl_array_eltype(val) == (void*)jl_bool_type, "Unexpected jl_array_t element type.");
+				log("unboxBoolArray - Vector{Bool} bytes");
+				unpackBytes((const uint8_t*)jl_array_data(val), jl_array_len(val), array);
+			}
+		}
+
+		template<>
+		struct ValueUnboxer<std::vector<bool>>
+		{
+			typedef std::vector<bool> type;
+
+			static type apply(jl_value_t* val)
+			{
+				std::vector<bool> array;
+				unboxBoolArray(val, array);
+				return array;
+			}
+		};
+
+		template<typename T>
+		struct ValueUnboxer<ArrayPointer<T>>
+		{
+			typedef ArrayPointer<T> type;
+
+			static type apply(jl_value_t* val)
+			{
+				JULIACPP_ASSERT(jl_is_array(val), "Unboxing ArrayPointer: jl_value_t is not an array.");
+				const auto len = jl_array_len(val);
+				ArrayPointer<T> array(new T[len], len);
+
+				unboxArray<ArrayPointer<T>, T>(val, array);
+				return array;
+			}
+		};
+
+		template <typename T>
+		static void unboxRaggedArray(jl_value_t* val, RaggedArray<T>& ragged)
+		{
+			JULIACPP_ASSERT(jl_is_array(val), "Unboxing RaggedArray: jl_value_t is not an array.");
+
+			jl_array_t* jlArray = (jl_array_t*)val;
+			const size_t numRows = jlArray->length;
+			jl_value_t** rows = (jl_value_t**)jlArray->data;
+			JULIACPP_ASSERT(jlArray->flags.ptrarray || numRows == 0, "Unboxing RaggedArray: rows must be arrays.");
+
+			bool rowsAreArrays = true;
+			size_t numValues = 0;
+			for (size_t i = 0; rowsAreArrays && i < numRows; i++)
+			{
+				rowsAreArrays = rows[i] != nullptr && jl_is_array(rows[i]);
+				if (rowsAreArrays)
+					numValues += jl_array_len(rows[i]);
+			}
+
+			if (!rowsAreArrays && numRows > 0)
+			{
+				// Views or other non-Array rows: let Julia flatten them into values and offsets.
+				// It throws if a row is not a vector.
+				log("unboxRaggedArray - flattening rows in Julia");
+				jl_value_t* flat = jl_call1(JULIACPP_HELPER("raggedFlatten"), val);
+				JULIACPP_ASSERT(flat != nullptr && jl_exception_occurred() == nullptr, "Could not flatten RaggedArray rows.");
+				JL_GC_PUSH1(&flat);
+				jl_value_t* values = jl_fieldref(flat, 0);
+				jl_value_t* offsets = jl_fieldref(flat, 1);
+				ragged._values.resize(jl_array_len(values));
+				ragged._offsets.resize(jl_array_len(offsets));
+				ArrayPointer<T> valuesView(ragged._values.data(), ragged._values.size());
+				ArrayPointer<int64_t> offsetsView(ragged._offsets.data(), ragged._offsets.size());
+				unboxArray<ArrayPointer<T>, T>(values, valuesView);
+				unboxArray<ArrayPointer<int64_t>, int64_t>(offsets, offsetsView);
+				JL_GC_POP();
+				return;
+			}
+
+			log("unboxRaggedArray - copying %d rows into one buffer", (int)numRows);
+			ragged._values.resize(numValues);
+			ragged._offsets.resize(numRows + 1);
+			ragged._offsets[0] = 0;
+			for (size_t i = 0; i < numRows; i++)
+			{
+				const size_t len = jl_array_len(rows[i]);
+				ArrayPointer<T> row(ragged._values.data() + ragged._offsets[i], len);
+				unboxArray<ArrayPointer<T>, T>(rows[i], row);
+				ragged._offsets[i+1] = ragged._offsets[i] + (int64_t)len;
+			}
+		}
+
+		template<typename T>
+		struct ValueUnboxer<RaggedArray<T>>
+		{
+			typedef RaggedArray<T> type;
+
+			static type apply(jl_value_t* val)
+			{
+				RaggedArray<T> ragged;
+				unboxRaggedArray<T>(val, ragged);
+				return ragged;
+			}
+		};
+	} // namespace Unboxer
+
+	namespace RefUnboxer
+	{
+		template <typename TArray, typename T>
+		static void unboxArrayByRef(jl_value_t* val, TArray& array);
+
+		template<typename... TReturns>
+		struct RefValueUnboxer
+		{
+			template <typename T>
+			static void unboxAt(jl_value_t* value, size_t index, T& outVal)
+			{
+				log("unboxing tuple at index %d", (int)index);
+				RefValueUnboxer<T>::apply(jl_fieldref(value, index), outVal);
+			}
+
+			template <typename T>
+			static void rec(jl_value_t* value, size_t idx, T& outVal)
+			{
+				unboxAt(value, idx, outVal);
+			}
+
+			template<typename T, typename... TArgs>
+			static void rec(jl_value_t* value, size_t idx, T& outVal, TArgs&... outVals)
+			{
+				rec(value, idx, outVal);
+				rec(value, idx+1, outVals...);
+			}
+
+			template<std::size_t... N>
+			static void unboxTuple(jl_value_t* value, std::tuple<TReturns&...>& tuple, Indices<N...>)
+			{
+				rec<TReturns...>(value, 0, std::get<N>(tuple)...);
+			}
+
+			static void apply(jl_value_t* value, std::tuple<TReturns&...>& tuple)
+			{
+				constexpr auto numReturns = sizeof...(TReturns);
+				static_assert(numReturns > 1, "This function call is for tuples.");
+
+				JULIACPP_ASSERT(jl_is_tuple(value), "Returned value is not a tuple.");
+				JULIACPP_ASSERT(jl_nfields(value) == numReturns, "Julia did not return the expected number of values.");
+
+				unboxTuple(value, tuple, typename IndicesBuilder<numReturns>::type());
+			}
+		};
+
+		template<typename T>
+		struct RefValueUnboxer<T>
+		{
+			static void apply(jl_value_t* value, T& outVal)
+			{
+				outVal = unbox<T>(value);
+			}
+		};
+
+		template<typename T, size_t N>
+		struct RefValueUnboxer<std::array<T, N>>
+		{
+			typedef std::array<T, N> type;
+
+			static void apply(jl_value_t* val, type& outArray)
+			{
+				unboxArrayByRef<std::array<T, N>, T>(val, outArray);
+			}
+		};
+
+		template<typename T>
+		struct RefValueUnboxer<std::vector<T>>
+		{
+			typedef std::vector<T> type;
+
+			static void apply(jl_value_t* val, type& outArray)
+			{
+				unboxArrayByRef<std::vector<T>, T>(val, outArray);
+			}
+		};
+
+		template<typename T>
+		struct RefValueUnboxer<ArrayPointer<T>>
+		{
+			typedef ArrayPointer<T> type;
+
+			static void apply(jl_value_t* val, type& outArray)
+			{
+				unboxArrayByRef<ArrayPointer<T>, T>(val, outArray);
+			}
+		};
+
+		template<>
+		struct RefValueUnboxer<std::vector<bool>>
+		{
+			typedef std::vector<bool> type;
+
+			static void apply(jl_value_t* val, type& outArray)
+			{
+				Unboxer::unboxBoolArray(val, outArray);
+			}
+		};
+
+		template<typename T>
+		struct RefValueUnboxer<RaggedArray<T>>
+		{
+			typedef RaggedArray<T> type;
+
+			static void apply(jl_value_t* val, type& outArray)
+			{
+				// Reuses the capacity of the existing buffers
+				Unboxer::unboxRaggedArray<T>(val, outArray);
+			}
+		};
+
+		template<typename T, size_t N>
+		struct RefValueUnboxer<T[N]>
+		{
+			static void apply(jl_value_t* val, T(& outArray)[N])
+			{
+				ArrayPointer<T> a(outArray);
+				unboxArrayByRef<ArrayPointer<T>, T>(val, a);
+			}
+		};
+
+		template <typename TArray, typename TElem>
+		static void unboxArrayByRef(jl_value_t* val, TArray& array)
+		{
+			static_assert(!std::is_const<TElem>::value, "Cannot unbox array of const type.");
+			JULIACPP_ASSERT(jl_is_array(val), "jl_value_t is not an array.");
+
+			jl_array_t* jlArray = (jl_array_t*)val;
 
 			const auto size = array.size();
 			JULIACPP_ASSERT(jlArray->length == size, "Invalid array length.");
 			if (jlArray->flags.ptrarray)
 			{
-				jl_value_t** data = (jl_value_t**)jlArray->data;
-				for (size_t i = 0; i < size; i++)
-				{
-					RefValueUnboxer<TElem>::apply(data[i], array[i]);
-				}
+				jl_value_t** data = (jl_value_t**)jlArray->data;
+				if (unboxHomogeneousPtrArray<TArray, TElem>(data, array, size))
+					return;
+
+				unboxCounters().slowPathElements.fetch_add(size, std::memory_order_relaxed);
+				for (size_t i = 0; i < size; i++)
+				{
+					RefValueUnboxer<TElem>::apply(data[i], array[i]);
+				}
+			}
+			else
+			{
+				JULIACPP_ASSERT(jl_array_eltype(val) == TypeTraits<TElem>::dataType(), "Unexpected jl_array_t element type.");
+				std::memcpy(array.data(), jlArray->data, sizeof(TElem) * size);
+				countBytesFromJulia(sizeof(TElem) * size);
+			}
+		}
+	} // namespace RefUnboxer
+
+	namespace Converter
+	{
+		// Arithmetic type used to compare and convert values of T
+		template<typename T> struct Arithmetic { typedef T type; };
+		template<> struct Arithmetic<Float16> { typedef float type; };
+
+		template<typename T>
+		struct IsConvertible
+		{
+			static constexpr bool value = std::is_arithmetic<T>::value || std::is_same<T, Float16>::value;
+		};
+
+		// ArrayPointer only refers to memory owned by the caller
+		template<typename T> struct IsArrayPointer : std::false_type { };
+		template<typename T> struct IsArrayPointer<ArrayPointer<T>> : std::true_type { };
+
+		template<typename T> inline double maxFinite() { return (double)std::numeric_limits<T>::max(); }
+		template<> inline double maxFinite<Float16>() { return 65504.0; }
+
+		// Integer target: the value must be representable without overflow
+		template<typename TDst, typename TSrc>
+		inline typename std::enable_if<std::is_integral<TDst>::value && std::is_integral<TSrc>::value, bool>::type
+		inRange(TSrc value)
+		{
+			if (std::is_signed<TSrc>::value && (intmax_t)value < 0)
+				return std::is_signed<TDst>::value && (intmax_t)value >= (intmax_t)std::numeric_limits<TDst>::lowest();
+			return (uintmax_t)value <= (uintmax_t)std::numeric_limits<TDst>::max();
+		}
+
+		template<typename TDst, typename TSrc>
+		inline typename std::enable_if<std::is_integral<TDst>::value && !std::is_integral<TSrc>::value, bool>::type
+		inRange(TSrc value)
+		{
+			// Powers of two are exact in every floating point type. NaN fails the comparisons.
+			const double upper = std::ldexp(1.0, std::numeric_limits<TDst>::digits);
+			const double x = (double)value;
+			return std::is_signed<TDst>::value ? (x >= -upper && x < upper) : (x > -1.0 && x < upper);
+		}
+
+		// Floating point target: finite values must not overflow to infinity
+		template<typename TDst, typename TSrc>
+		inline typename std::enable_if<!std::is_integral<TDst>::value, bool>::type
+		inRange(TSrc value)
+		{
+			const double x = (double)value;
+			return !(std::fabs(x) > maxFinite<TDst>()) || std::isinf(x);
+		}
+
+		template<typename TDst, typename TSrc>
+		void convertElements(const TSrc* src, TDst* dst, size_t size, ConversionCheck check)
+		{
+			typedef typename Arithmetic<TSrc>::type ArithSrc;
+			typedef typename Arithmetic<TDst>::type ArithDst;
+
+			// Separate branch-free loops so that each one can be vectorized
+			if (check != ConversionCheck::None)
+			{
+				bool valid = true;
+				for (size_t i = 0; i < size; i++)
+					valid &= inRange<TDst>((ArithSrc)src[i]);
+				JULIACPP_ASSERT(valid, "Value out of range for the target type.");
+			}
+
+			for (size_t i = 0; i < size; i++)
+				dst[i] = static_cast<TDst>(static_cast<ArithSrc>(src[i]));
+
+			if (check == ConversionCheck::Exact)
+			{
+				bool exact = true;
+				for (size_t i = 0; i < size; i++)
+				{
+					const ArithSrc a = static_cast<ArithSrc>(src[i]);
+					const ArithSrc b = static_cast<ArithSrc>(static_cast<ArithDst>(dst[i]));
+					exact &= (a == b) | ((a != a) & (b != b)); // NaN converts to NaN
+				}
+				JULIACPP_ASSERT(exact, "Value not exactly representable in the target type.");
+			}
+		}
+
+		template<typename TDst>
+		void convertFrom(jl_value_t* elementType, const void* src, TDst* dst, size_t size, ConversionCheck check)
+		{
+			countBytesFromJulia(sizeof(TDst) * size);
+			if (elementType == (jl_value_t*)dataTypeOf<TDst>() && check == ConversionCheck::None)
+				std::memcpy(dst, src, sizeof(TDst) * size);
+			else if (elementType == (jl_value_t*)jl_int8_type) convertElements((const int8_t*)src, dst, size, check);
+			else if (elementType == (jl_value_t*)jl_int16_type) convertElements((const int16_t*)src, dst, size, check);
+			else if (elementType == (jl_value_t*)jl_int32_type) convertElements((const int32_t*)src, dst, size, check);
+			else if (elementType == (jl_value_t*)jl_int64_type) convertElements((const int64_t*)src, dst, size, check);
+			else if (elementType == (jl_value_t*)jl_uint8_type) convertElements((const uint8_t*)src, dst, size, check);
+			else if (elementType == (jl_value_t*)jl_uint16_type) convertElements((const uint16_t*)src, dst, size, check);
+			else if (elementType == (jl_value_t*)jl_uint32_type) convertElements((const uint32_t*)src, dst, size, check);
+			else if (elementType == (jl_value_t*)jl_uint64_type) convertElements((const uint64_t*)src, dst, size, check);
+			else if (elementType == (jl_value_t*)jl_float16_type) convertElements((const Float16*)src, dst, size, check);
+			else if (elementType == (jl_value_t*)jl_float32_type) convertElements((const float*)src, dst, size, check);
+			else if (elementType == (jl_value_t*)jl_float64_type) convertElements((const double*)src, dst, size, check);
+			else JULIACPP_ASSERT(false, "No numeric conversion for jl_value_t type.");
+		}
+
+		template<typename T>
+		inline typename std::enable_if<IsConvertible<T>::value>::type
+		convertValue(jl_value_t* val, T& out, ConversionCheck check)
+		{
+			convertFrom(jl_typeof(val), jl_data_ptr(val), &out, 1, check);
+		}
+
+		template<typename T>
+		void convertArray(jl_value_t* val, T* out, size_t size, ConversionCheck check)
+		{
+			static_assert(IsConvertible<T>::value, "convertTo only supports numeric element types.");
+			JULIACPP_ASSERT(jl_is_array(val), "jl_value_t is not an array.");
+
+			jl_array_t* jlArray = (jl_array_t*)val;
+			JULIACPP_ASSERT(jlArray->length == size, "Invalid array length.");
+
+			if (jlArray->flags.ptrarray)
+			{
+				jl_value_t** data = (jl_value_t**)jlArray->data;
+				for (size_t i = 0; i < size; i++)
+					convertValue(data[i], out[i], check);
+			}
+			else
+			{
+				convertFrom((jl_value_t*)jl_array_eltype(val), jlArray->data, out, size, check);
+			}
+		}
+
+		template<typename T>
+		void convertValue(jl_value_t* val, std::vector<T>& out, ConversionCheck check)
+		{
+			JULIACPP_ASSERT(jl_is_array(val), "Converting std::vector: jl_value_t is not an array.");
+			out.resize(jl_array_len(val));
+			convertArray(val, out.data(), out.size(), check);
+		}
+
+		template<typename T, size_t N>
+		void convertValue(jl_value_t* val, std::array<T, N>& out, ConversionCheck check)
+		{
+			convertArray(val, out.data(), N, check);
+		}
+
+		template<typename T, size_t N>
+		void convertValue(jl_value_t* val, T(& out)[N], ConversionCheck check)
+		{
+			convertArray(val, out, N, check);
+		}
+
+		template<typename T>
+		void convertValue(jl_value_t* val, ArrayPointer<T>& out, ConversionCheck check)
+		{
+			convertArray(val, out._data, out._len, check);
+		}
+	} // namespace Converter
+
+
+	template<typename... TReturns>
+	inline typename Unboxer::ValueUnboxer<TReturns...>::type unboxValue(jl_value_t* value)
+	{
+		return Unboxer::ValueUnboxer<TReturns...>::apply(value);
+	}
+
+	template<typename T>
+	inline void unboxValueByRef(jl_value_t* val, std::tuple<T&>& returns)
+	{
+		RefUnboxer::RefValueUnboxer<T>::apply(val, std::get<0>(returns));
+	}
+
+	template<typename... TReturns>
+	inline void unboxValueByRef(jl_value_t* val, std::tuple<TReturns&...>& returns)
+	{
+		RefUnboxer::RefValueUnboxer<TReturns...>::apply(val, returns);
+	}
+} // namespace Impl
+
+
+struct UnboxStats
+{
+	size_t fastPathElements; // Array{Any} elements copied in bulk
+	size_t slowPathElements; // Array{Any} elements unboxed one at a time
+};
+
+inline UnboxStats getUnboxStats()
+{
+	auto& counters = Impl::unboxCounters();
+	return UnboxStats { counters.fastPathElements.load(), counters.slowPathElements.load() };
+}
+
+inline void resetUnboxStats()
+{
+	auto& counters = Impl::unboxCounters();
+	counters.fastPathElements = 0;
+	counters.slowPathElements = 0;
+}
+
+struct PhaseStats
+{
+	uint64_t _count;
+	double _totalSeconds;
+	double _p50Seconds;
+	double _p99Seconds;
+};
+
+struct CallStats
+{
+	std::string _functionName;  // Module.function, or function for modules without a name
+	PhaseStats _phases[4];      // indexed by CallPhase
+	uint64_t _bytesToJulia;     // bytes copied into Julia arrays and strings
+	uint64_t _bytesFromJulia;   // bytes copied out of Julia arrays and strings
+	uint64_t _gcAllocatedBytes; // bytes allocated by Julia while boxing and running the function
+	uint64_t _gcCollections;    // collections during calls, 0 without gcCollectionsAvailable()
+	uint64_t _callsWithGc;      // calls during which the GC paused
+	double _gcPauseSeconds;     // total GC pause time during calls
+
+	const PhaseStats& phase(CallPhase phase) const { return _phases[(size_t)phase]; }
+};
+
+// Statistics of every function called so far. Only collected if
+// JULIACPP_ENABLE_CALL_STATS is defined, otherwise the result is empty.
+inline std::vector<CallStats> getCallStats()
+{
+	std::vector<CallStats> stats;
+	Impl::CallStatsRegistry::instance().forEach([&](const Impl::CallStatsEntry& entry)
+	{
+		CallStats functionStats;
+		functionStats._functionName = entry._functionName;
+		for (size_t i = 0; i < 4; i++)
+		{
+			const auto& histogram = entry._phases[i];
+			functionStats._phases[i] = PhaseStats { histogram.count(), histogram.totalNs() * 1e-9,
+				histogram.percentileNs(0.5) * 1e-9, histogram.percentileNs(0.99) * 1e-9 };
+		}
+		functionStats._bytesToJulia = entry._bytesToJulia.load(std::memory_order_relaxed);
+		functionStats._bytesFromJulia = entry._bytesFromJulia.load(std::memory_order_relaxed);
+		functionStats._gcAllocatedBytes = entry._gcAllocatedBytes.load(std::memory_order_relaxed);
+		functionStats._gcCollections = entry._gcCollections.load(std::memory_order_relaxed);
+		functionStats._callsWithGc = entry._callsWithGc.load(std::memory_order_relaxed);
+		functionStats._gcPauseSeconds = entry._gcPauseNs.load(std::memory_order_relaxed) * 1e-9;
+		stats.push_back(functionStats);
+	});
+	return stats;
+}
+
+// Whether CallStats::_gcCollections is recorded. The count is read with
+// jl_gc_num(), whose struct is internal to Julia, so it is only used if its
+// layout matches Base.GC_Num. Requires an initialized Julia.
+inline bool gcCollectionsAvailable()
+{
+	return Impl::hasGcNum();
+}
+
+inline void resetCallStats()
+{
+	Impl::CallStatsRegistry::instance().forEach([](Impl::CallStatsEntry& entry)
+	{
+		for (auto& histogram : entry._phases)
+			histogram.reset();
+		entry._bytesToJulia.store(0, std::memory_order_relaxed);
+		entry._bytesFromJulia.store(0, std::memory_order_relaxed);
+		entry._gcAllocatedBytes.store(0, std::memory_order_relaxed);
+		entry._gcCollections.store(0, std::memory_order_relaxed);
+		entry._callsWithGc.store(0, std::memory_order_relaxed);
+		entry._gcPauseNs.store(0, std::memory_order_relaxed);
+	});
+}
+
+struct StartupPhase
+{
+	enum class Kind { Init, Load, FirstCall };
+
+	Kind _kind;
+	std::string _name; // image, file, package or function name
+	double _seconds;
+};
+
+// Optional timing of the phases that make up startup latency: jl_init, each
+// loaded file or package, and the first call of each function. Julia 0.6 has
+// no separate JIT timer, so the compile time of a function is the duration
+// of its first call. Enable before initJulia to include the runtime
+// initialization.
+class StartupProfile
+{
+public:
+
+	struct Timer
+	{
+		bool _active;
+		std::chrono::steady_clock::time_point _start;
+	};
+
+	static StartupProfile& instance()
+	{
+		static StartupProfile profile;
+		return profile;
+	}
+
+	void enable(bool enabled = true) { _enabled = enabled; }
+
+	bool isEnabled() const { return _enabled; }
+
+	Timer start()
+	{
+		if (!_enabled)
+			return Timer { false, {} };
+
+		return Timer { true, std::chrono::steady_clock::now() };
+	}
+
+	void stop(const Timer& timer, StartupPhase::Kind kind, const std::string& name)
+	{
+		if (!timer._active)
+			return;
+
+		const std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - timer._start;
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		_phases.push_back(StartupPhase { kind, name, seconds.count() });
+	}
+
+	std::vector<StartupPhase> getPhases() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _phases;
+	}
+
+	double totalSeconds(StartupPhase::Kind kind) const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		double total = 0.0;
+		for (auto& phase : _phases)
+		{
+			if (phase._kind == kind)
+				total += phase._seconds;
+		}
+		return total;
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_phases.clear();
+	}
+
+private:
+	StartupProfile() : _enabled(false) { }
+
+	std::atomic<bool> _enabled;
+	mutable std::mutex _mutex;
+	std::vector<StartupPhase> _phases;
+};
+
+inline void initJulia()
+{
+	auto timer = StartupProfile::instance().start();
+	jl_init(nullptr);
+	StartupProfile::instance().stop(timer, StartupPhase::Kind::Init, "");
+}
+
+inline void initJulia(const std::string& homeDir)
+{
+	auto timer = StartupProfile::instance().start();
+	jl_init(homeDir.c_str());
+	StartupProfile::instance().stop(timer, StartupPhase::Kind::Init, "");
+}
+
+// Starts from a custom system image, e.g. one with packages compiled in.
+// imagePath is absolute or relative to homeDir.
+inline void initJulia(const std::string& homeDir, const std::string& imagePath)
+{
+	auto timer = StartupProfile::instance().start();
+	jl_init_with_image(homeDir.c_str(), imagePath.c_str());
+	StartupProfile::instance().stop(timer, StartupPhase::Kind::Init, imagePath);
+}
+
+// Runtime settings applied before Julia starts. Fields left at their
+// defaults keep Julia's own defaults.
+struct InitOptions
+{
+	enum class CheckBounds { Default, On, Off };
+	enum class CompileMode { Default, On, Off, All, Min };
+
+	std::string _homeDir;
+	std::string _imagePath;        // custom system image, see initJulia(homeDir, imagePath)
+	int _threads = 0;              // number of Julia threads, 0 for the default
+	int _optLevel = -1;            // 0 to 3, -1 for the default
+	CheckBounds _checkBounds = CheckBounds::Default;
+	CompileMode _compileMode = CompileMode::Default;
+	uint64_t _heapSizeHint = 0;    // in bytes, 0 for the default; requires Julia 1.9
+
+	// Short JIT pauses: less optimization means faster compilation of new
+	// signatures at the cost of slower steady-state code.
+	static InitOptions lowLatency()
+	{
+		InitOptions options;
+		options._optLevel = 1;
+		return options;
+	}
+
+	// Fully optimized code and one Julia thread per hardware thread. Bounds
+	// checks keep their default, disabling them globally is unsafe.
+	static InitOptions maxThroughput()
+	{
+		InitOptions options;
+		options._optLevel = 3;
+		options._threads = (int)std::thread::hardware_concurrency();
+		return options;
+	}
+
+	void apply() const
+	{
+		if (_threads > 0)
+		{
+			// Read by Julia during initialization
+			const std::string threads = std::to_string(_threads);
+#ifdef _WIN32
+			_putenv_s("JULIA_NUM_THREADS", threads.c_str());
+#else
+			setenv("JULIA_NUM_THREADS", threads.c_str(), 1);
+#endif
+		}
+
+		if (_optLevel >= 0)
+		{
+			JULIACPP_ASSERT(_optLevel <= 3, "Optimization level must be between 0 and 3.");
+			jl_options.opt_level = (int8_t)_optLevel;
+		}
+
+		switch (_checkBounds)
+		{
+			case CheckBounds::Default: break;
+			case CheckBounds::On: jl_options.check_bounds = JL_OPTIONS_CHECK_BOUNDS_ON; break;
+			case CheckBounds::Off: jl_options.check_bounds = JL_OPTIONS_CHECK_BOUNDS_OFF; break;
+		}
+
+		switch (_compileMode)
+		{
+			case CompileMode::Default: break;
+			case CompileMode::On: jl_options.compile_enabled = JL_OPTIONS_COMPILE_ON; break;
+			case CompileMode::Off: jl_options.compile_enabled = JL_OPTIONS_COMPILE_OFF; break;
+			case CompileMode::All: jl_options.compile_enabled = JL_OPTIONS_COMPILE_ALL; break;
+			case CompileMode::Min: jl_options.compile_enabled = JL_OPTIONS_COMPILE_MIN; break;
+		}
+
+		if (_heapSizeHint > 0)
+		{
+#if JULIA_VERSION_MAJOR > 1 || (JULIA_VERSION_MAJOR == 1 && JULIA_VERSION_MINOR >= 9)
+			jl_options.heap_size_hint = _heapSizeHint;
+#else
+			JULIACPP_ASSERT(_heapSizeHint == 0, "Heap size hints require Julia 1.9 or newer.");
+#endif
+		}
+	}
+};
+
+inline void initJulia(const InitOptions& options)
+{
+	JULIACPP_ASSERT(!jl_is_initialized(), "Julia is already initialized.");
+	options.apply();
+
+	auto timer = StartupProfile::instance().start();
+	const char* homeDir = options._homeDir.empty() ? nullptr : options._homeDir.c_str();
+	if (options._imagePath.empty())
+		jl_init(homeDir);
+	else
+		jl_init_with_image(homeDir, options._imagePath.c_str());
+	StartupProfile::instance().stop(timer, StartupPhase::Kind::Init, options._imagePath);
+}
+
+inline void shutdownJulia(int status = 0)
+{
+	Impl::juliaShutDown() = true;
+	jl_atexit_hook(status);
+}
+
+// Disables Julia's garbage collector for the current scope and restores the
+// previous state afterwards, so scopes can be nested. Allocations still
+// count, so the first allocation after the scope may start a collection.
+class GcPause
+{
+public:
+	GcPause() : _wasEnabled(jl_gc_enable(0) != 0), _active(true) { }
+	~GcPause() { resume(); }
+
+	// Ends the pause before the end of the scope
+	void resume()
+	{
+		if (_active)
+		{
+			jl_gc_enable(_wasEnabled ? 1 : 0);
+			_active = false;
+		}
+	}
+
+	GcPause(const GcPause&) = delete;
+	GcPause& operator=(const GcPause&) = delete;
+
+private:
+	bool _wasEnabled;
+	bool _active;
+};
+
+enum class GcCollection { Incremental, Full };
+
+// Runs a collection now, e.g. in an idle window between bursts of calls.
+// Does nothing while the collector is disabled (see GcPause).
+inline void collectNow(GcCollection collection = GcCollection::Incremental)
+{
+#if JULIA_VERSION_MAJOR > 1 || (JULIA_VERSION_MAJOR == 1 && JULIA_VERSION_MINOR >= 4)
+	jl_gc_collect(collection == GcCollection::Full ? JL_GC_FULL : JL_GC_INCREMENTAL);
+#else
+	jl_gc_collect(collection == GcCollection::Full ? 1 : 0);
+#endif
+}
+
+namespace Impl
+{
+	struct HeapGrowthTrigger
+	{
+		std::atomic<bool> _armed { false };
+		std::mutex _mutex;
+		int64_t _threshold = 0;
+		int64_t _baseline = 0;
+		std::function<void(int64_t)> _callback;
+	};
+
+	inline HeapGrowthTrigger& heapGrowthTrigger()
+	{
+		static HeapGrowthTrigger trigger;
+		return trigger;
+	}
+
+	// Called before the arguments of a call are boxed, so the callback may
+	// safely run a collection. Values boxed earlier at the call site, i.e.
+	// KeywordArgs, are rooted until the call has finished.
+	inline void checkHeapGrowth()
+	{
+		auto& trigger = heapGrowthTrigger();
+		if (!trigger._armed.load(std::memory_order_relaxed))
+			return;
+
+		std::function<void(int64_t)> callback;
+		int64_t growth = 0;
+		{
+			std::lock_guard<std::mutex> lock(trigger._mutex);
+			growth = jl_gc_total_bytes() - trigger._baseline;
+			if (!trigger._callback || growth < trigger._threshold)
+				return;
+
+			trigger._baseline += growth;
+			callback = trigger._callback;
+		}
+		callback(growth);
+	}
+}
+
+// Calls callback(bytes) once Julia has allocated at least thresholdBytes
+// since the last time it was called. The check runs before each
+// JuliaModule::call, on the calling thread.
+inline void onHeapGrowth(int64_t thresholdBytes, std::function<void(int64_t)> callback)
+{
+	JULIACPP_ASSERT(thresholdBytes > 0, "Heap growth threshold must be positive.");
+	auto& trigger = Impl::heapGrowthTrigger();
+	std::lock_guard<std::mutex> lock(trigger._mutex);
+	trigger._threshold = thresholdBytes;
+	trigger._baseline = jl_gc_total_bytes();
+	trigger._callback = std::move(callback);
+	trigger._armed = (bool)trigger._callback;
+}
+
+inline void clearHeapGrowthCallback()
+{
+	auto& trigger = Impl::heapGrowthTrigger();
+	std::lock_guard<std::mutex> lock(trigger._mutex);
+	trigger._callback = nullptr;
+	trigger._armed = false;
+}
+
+struct IntermediateValue
+{
+	IntermediateValue() = default;
+	IntermediateValue(jl_value_t* jlvalue) : _jlvalue(jlvalue) { };
+
+	jl_value_t* _jlvalue;
+
+	Impl::CallStatsEntry* _stats = nullptr; // receives the unbox time, if set
+	inline Impl::CallStatsEntry* getCallStats() const { return _stats; }
+
+	template <typename T>
+	inline operator T()
+	{
+		Impl::PhaseTimer timer(getCallStats(), CallPhase::Unbox);
+		return Impl::Unboxer::ValueUnboxer<T>::apply(_jlvalue);
+	}
+
+	// Converts numeric values and arrays to T instead of requiring an exact type match
+	template <typename T>
+	inline T convertTo(ConversionCheck check = ConversionCheck::None)
+	{
+		static_assert(!Impl::Converter::IsArrayPointer<T>::value, "ArrayPointer has no storage to convert into, use convertTo(arrayPointer) instead.");
+		Impl::PhaseTimer timer(getCallStats(), CallPhase::Unbox);
+		T result;
+		Impl::Converter::convertValue(_jlvalue, result, check);
+		return result;
+	}
+
+	inline jl_value_t* getJuliaValue() { return _jlvalue; }
+};
+
+template <typename T>
+inline T unboxJuliaValue(jl_value_t* value)
+{
+	return Impl::unboxValue<T>(value);
+}
+
+inline IntermediateValue unboxJuliaValue(jl_value_t* value)
+{
+	return IntermediateValue(value);
+}
+
+template <typename... T>
+class Tuple
+{
+public:
+	Tuple(T&... args) : _tuple(args...) {}
+
+	void operator=(IntermediateValue&& value)
+	{
+		Impl::PhaseTimer timer(value.getCallStats(), CallPhase::Unbox);
+		_tuple = Impl::unboxValue<typename std::remove_reference<T>::type...>(value._jlvalue);
+	}
+
+private:
+	std::tuple<T&...> _tuple;
+};
+
+template <typename... T>
+Tuple<T&...> tie(T&... args)
+{
+	return Tuple<T&...>(args...);
+}
+
+template <typename... T>
+struct TupleNoAlloc
+{
+public:
+	TupleNoAlloc(T&... args) : _tuple(args...) {}
+
+	void operator=(IntermediateValue&& value)
+	{
+		Impl::PhaseTimer timer(value.getCallStats(), CallPhase::Unbox);
+		Impl::unboxValueByRef<typename std::remove_reference<T>::type...>(value._jlvalue, _tuple);
+	}
+
+private:
+	std::tuple<T&...> _tuple;
+};
+
+template <typename... T>
+TupleNoAlloc<T&...> tieNoAlloc(T&... args)
+{
+	return TupleNoAlloc<T&...>(args...);
+}
+
+template <typename T>
+TupleNoAlloc<T&> noAlloc(T& arg)
+{
+	return TupleNoAlloc<T&>(arg);
+}
+
+template <typename T>
+struct ConvertedValue
+{
+public:
+	ConvertedValue(T& value, ConversionCheck check) : _value(value), _check(check) {}
+
+	void operator=(IntermediateValue&& value)
+	{
+		Impl::PhaseTimer timer(value.getCallStats(), CallPhase::Unbox);
+		Impl::Converter::convertValue(value._jlvalue, _value, _check);
+	}
+
+private:
+	T& _value;
+	ConversionCheck _check;
+};
+
+template <typename T>
+ConvertedValue<T> convertTo(T& arg, ConversionCheck check = ConversionCheck::None)
+{
+	return ConvertedValue<T>(arg, check);
+}
+
+struct KeywordArgs
+{
+	template <typename T>
+	KeywordArgs(const std::string& key, T&& value)
+	{
+		add(key, Impl::box(std::forward<T>(value)));
+	}
+
+	template <typename T>
+	KeywordArgs&& operator()(const std::string& key, T&& value) &&
+	{
+		add(key, Impl::box(std::forward<T>(value)));
+		return std::move(*this);
+	}
+
+	jl_value_t* value(size_t index) const { return jl_array_ptr_data(_values.get())[index]; }
+
+	struct Entry
+	{
+		jl_sym_t* _symbol; // interned when the keyword is added
+		size_t _index;     // into _values
+	};
+
+	// The values are boxed at the call site, before the call pauses the GC,
+	// so they are kept alive in a rooted array until the KeywordArgs is gone
+	std::map<std::string, Entry> _map;
+	Impl::RootedValue _values;
+
+private:
+	void add(const std::string& key, jl_value_t* value)
+	{
+		jl_array_t* values = nullptr;
+		JL_GC_PUSH2(&value, &values);
+		values = (jl_array_t*)_values.get();
+		if (values == nullptr)
+		{
+			// reset() may allocate as well, so the new vector is in this frame too
+			values = jl_alloc_vec_any(0);
+			_values.reset((jl_value_t*)values);
+		}
+
+		auto it = _map.find(key);
+		if (it != _map.end())
+		{
+			jl_arrayset(values, value, it->second._index);
+		}
+		else
+		{
+			_map[key] = Entry { Impl::internSymbol(key), jl_array_len(values) };
+			jl_array_ptr_1d_push(values, value);
+		}
+		JL_GC_POP();
+	}
+};
+
+namespace Impl
+{
+	static jl_value_t* boxKeywordArgs(const KeywordArgs& keywordArgs)
+	{
+		const size_t numArgs = keywordArgs._map.size();
+		jl_datatype_t* dataType = jl_any_type;
+
+		jl_value_t* arrayType = jl_apply_array_type(dataType, 1);
+		jl_array_t* array = jl_alloc_array_1d(arrayType, numArgs * 2);
+
+		jl_value_t** arrayData = (jl_value_t**)jl_array_data(array);
+		size_t i = 0;
+		for(auto& kv : keywordArgs._map)
+		{
+			arrayData[i] = (jl_value_t*)kv.second._symbol;
+			arrayData[i+1] = keywordArgs.value(kv.second._index);
+
+			i += 2;
+		}
+
+		return (jl_value_t*)array;
+	}
+}
+
+
+// Error part of CallResult. A Julia exception is kept rooted and only
+// formatted (with Base.showerror) when message() is called. Results may be
+// destroyed after shutdownJulia(), but then exception() returns nullptr and
+// message() only the error type, unless it was requested before.
+class CallError
+{
+public:
+	CallError() : _errorType(nullptr), _slot(noSlot) { }
+	~CallError() { releaseException(); }
+
+	CallError(CallError&& other) : _errorType(other._errorType), _slot(other._slot), _message(std::move(other._message))
+	{
+		other._errorType = nullptr;
+		other._slot = noSlot;
+	}
+
+	CallError& operator=(CallError&& other)
+	{
+		if (this != &other)
+		{
+			releaseException();
+			_errorType = other._errorType;
+			_slot = other._slot;
+			_message = std::move(other._message);
+			other._errorType = nullptr;
+			other._slot = noSlot;
+		}
+		return *this;
+	}
+
+	CallError(const CallError&) = delete;
+	CallError& operator=(const CallError&) = delete;
+
+	bool hasError() const { return _errorType != nullptr; }
+
+	// Name of the Julia exception type, "JuliaCppException" for errors on the
+	// C++ side (e.g. an unexpected return type), nullptr without an error
+	const char* errorType() const { return _errorType; }
+
+	// The Julia exception, nullptr for C++ errors
+	jl_value_t* exception() const { return _slot != noSlot ? Impl::RootPool::instance().get(_slot) : nullptr; }
+
+	const std::string& message() const
+	{
+		if (_message.empty() && _slot != noSlot)
+		{
+			jl_value_t* exception = this->exception();
+			if (exception == nullptr)
+				return _message = _errorType;
+
+			jl_value_t* message = jl_call1(JULIACPP_HELPER("errorMessage"), exception);
+			if (message != nullptr && jl_exception_occurred() == nullptr)
+				_message = jl_string_data(message);
+			else
+				_message = _errorType;
+			jl_exception_clear();
+		}
+		return _message;
+	}
+
+	void setException(jl_value_t* exception)
+	{
+		releaseException();
+		_errorType = jl_typeof_str(exception);
+		_slot = Impl::RootPool::instance().add(exception);
+	}
+
+	void setError(const std::string& message)
+	{
+		releaseException();
+		_errorType = "JuliaCppException";
+		_message = message;
+	}
+
+private:
+	static constexpr size_t noSlot = (size_t)-1;
+
+	void releaseException()
+	{
+		if (_slot != noSlot)
+			Impl::RootPool::instance().release(_slot);
+		_slot = noSlot;
+	}
+
+	const char* _errorType;
+	size_t _slot;
+	mutable std::string _message;
+};
+
+// Result of JuliaModule::tryCall: either a value or an error
+template <typename T>
+class CallResult : public CallError
+{
+public:
+	CallResult() : _value() { }
+
+	bool hasValue() const { return !hasError(); }
+	explicit operator bool() const { return hasValue(); }
+
+	T& value()
+	{
+		JULIACPP_ASSERT(hasValue(), std::string("CallResult holds an error: ") + errorType());
+		return _value;
+	}
+
+	T valueOr(T defaultValue) const { return hasValue() ? _value : defaultValue; }
+
+	void setValue(jl_value_t* value) { _value = Impl::unboxValue<T>(value); }
+
+private:
+	T _value;
+};
+
+template <>
+class CallResult<void> : public CallError
+{
+public:
+	bool hasValue() const { return !hasError(); }
+	explicit operator bool() const { return hasValue(); }
+
+	void setValue(jl_value_t*) { }
+};
+
+#ifdef JULIACPP_HAS_DIRECT_INVOKE
+// Exported by libjulia but not declared in julia.h
+extern "C"
+{
+	jl_method_instance_t* jl_get_specialization1(jl_tupletype_t* types, size_t world);
+	jl_value_t* jl_invoke(jl_method_instance_t* meth, jl_value_t** args, uint32_t nargs);
+}
+
+namespace Impl
+{
+	// The method instance generic dispatch selects for the function and
+	// argument types in the current world, nullptr if there is none
+	inline jl_method_instance_t* methodInstance(jl_function_t* func, const std::vector<jl_value_t*>& argumentTypes)
+	{
+		std::vector<jl_value_t*> types;
+		types.reserve(argumentTypes.size() + 1);
+		types.push_back(jl_typeof(func));
+		types.insert(types.end(), argumentTypes.begin(), argumentTypes.end());
+
+		jl_value_t* tupleType = (jl_value_t*)jl_apply_tuple_type_v(types.data(), types.size());
+		JL_GC_PUSH1(&tupleType);
+		jl_method_instance_t* instance = jl_get_specialization1((jl_tupletype_t*)tupleType, jl_get_world_counter());
+		JL_GC_POP();
+		return instance;
+	}
+
+	// Like jl_call, but skips the method table lookup. Runs in the latest
+	// world and leaves Julia exceptions pending.
+	inline jl_value_t* invokeMethodInstance(jl_method_instance_t* instance, jl_function_t* func, jl_value_t** args, size_t nargs)
+	{
+		jl_value_t** argv;
+		JL_GC_PUSHARGS(argv, nargs + 1);
+		argv[0] = func;
+		for (size_t i = 0; i < nargs; i++)
+			argv[i + 1] = args[i];
+
+		jl_ptls_t ptls = jl_get_ptls_states();
+		const size_t lastAge = ptls->world_age;
+		jl_value_t* volatile ret = nullptr;
+		JL_TRY
+		{
+			ptls->world_age = jl_get_world_counter();
+			ret = jl_invoke(instance, argv, (uint32_t)(nargs + 1));
+			jl_exception_clear();
+		}
+		JL_CATCH
+		{
+			ret = nullptr;
+		}
+		ptls->world_age = lastAge;
+
+		JL_GC_POP();
+		return ret;
+	}
+
+	// Whether the instance can run without invoking the JIT. Julia 0.6
+	// generates the entry point on the first call, also after precompile.
+	// jlcall_api 2 marks methods that only return a constant.
+	inline bool isCompiled(const jl_method_instance_t* instance)
+	{
+		return instance->jlcall_api == 2 || instance->fptr != nullptr;
+	}
+}
+#endif
+
+template <typename... T>
+struct KwValues;
+
+// Keyword argument names declared once, e.g. at startup, for calls that pass
+// the same keywords every time. The symbols are interned when the schema is
+// created and the keyword array passed to Julia is allocated once and
+// reused, so a keyword call boxes only its values:
+//
+//   static const KwSchema plotKeywords { "x", "y" };
+//   module.call("plot", plotKeywords(x, y));
+//
+// A schema must not be used by calls on different threads at the same time.
+class KwSchema
+{
+public:
+	KwSchema(std::initializer_list<std::string> names)
+		: _size(names.size())
+	{
+		JULIACPP_ASSERT(_size > 0, "KwSchema needs at least one keyword.");
+
+		jl_array_t* layout = nullptr;
+		JL_GC_PUSH1(&layout);
+		layout = jl_alloc_array_1d(jl_apply_array_type(jl_any_type, 1), 2 * _size);
+		_slot = Impl::RootPool::instance().add((jl_value_t*)layout);
+		JL_GC_POP();
+
+		size_t i = 0;
+		for (auto& name : names)
+		{
+			jl_arrayset(layout, (jl_value_t*)Impl::internSymbol(name), 2 * i);
+			jl_arrayset(layout, jl_nothing, 2 * i + 1);
+			i++;
+		}
+	}
+
+	~KwSchema() { Impl::RootPool::instance().release(_slot); }
+
+	KwSchema(const KwSchema&) = delete;
+	KwSchema& operator=(const KwSchema&) = delete;
+
+	// Values in the order of the names
+	template <typename... T>
+	KwValues<T...> operator()(T&&... values) const
+	{
+		JULIACPP_ASSERT(sizeof...(T) == _size, "Number of keyword values does not match the KwSchema.");
+		return KwValues<T...> { *this, std::forward_as_tuple(std::forward<T>(values)...) };
+	}
+
+	size_t size() const { return _size; }
+
+	// Alternating symbols and values, the layout kwsorter expects
+	jl_array_t* layout() const { return (jl_array_t*)Impl::RootPool::instance().get(_slot); }
+
+	// Drops the references to the values of the last call
+	void clearValues() const
+	{
+		jl_array_t* array = layout();
+		if (array == nullptr)
+			return; // Julia has shut down
+		for (size_t i = 0; i < _size; i++)
+			jl_arrayset(array, jl_nothing, 2 * i + 1);
+	}
+
+private:
+	size_t _size;
+	size_t _slot;
+};
+
+// Keyword values of one call, created by KwSchema::operator(). Values are
+// boxed directly into the schema's keyword array when the call is made.
+template <typename... T>
+struct KwValues
+{
+	const KwSchema& _schema;
+	std::tuple<T&&...> _values;
+
+	jl_value_t* box() const { return box(typename Impl::IndicesBuilder<sizeof...(T)>::type()); }
+
+private:
+	template <std::size_t... Is>
+	jl_value_t* box(Impl::Indices<Is...>) const
+	{
+		jl_array_t* array = _schema.layout();
+		int unused[] = { 0, (jl_arrayset(array, Impl::box(std::get<Is>(_values)), 2 * Is + 1), 0)... };
+		(void)unused;
+		return (jl_value_t*)array;
+	}
+};
+
+// Records every (function, argument types) pair that reaches
+// JuliaModule::call as a `precompile` statement in a file. On the next start,
+// replay() compiles the recorded signatures before any traffic arrives, so
+// the warm-up set follows real usage. Keyword calls are recorded with their
+// positional argument types.
+class CompileTrace
+{
+public:
+
+	static CompileTrace& instance()
+	{
+		static CompileTrace trace;
+		return trace;
+	}
+
+	// Appends new signatures to filePath. Statements already in the file are not written again.
+	void startRecording(const std::string& filePath)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		readStatements(filePath, _statements);
+		_file.close();
+		_file.clear();
+		_file.open(filePath, std::ios::app);
+		JULIACPP_ASSERT(_file.is_open(), "Could not open compile trace '" + filePath + "'.");
+		_recording = true;
+	}
+
+	void stopRecording()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_recording = false;
+		_file.close();
+	}
+
+	bool isRecording() const { return _recording; }
+
+	// Records a successful positional call. Keyword calls are not recorded
+	// since the statement would only cover the positional arguments.
+	void record(jl_module_t* module, const std::string& functionName, const std::vector<jl_value_t*>& argumentTypes)
+	{
+		std::vector<jl_value_t*> key { (jl_value_t*)module };
+		key.insert(key.end(), argumentTypes.begin(), argumentTypes.end());
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_recording || !_signatures.insert(std::make_pair(functionName, key)).second)
+			return;
+
+		jl_value_t* types = nullptr;
+		jl_value_t* name = nullptr;
+		JL_GC_PUSH2(&types, &name);
+		// The module and types are keys of _signatures, so they must stay alive
+		types = (jl_value_t*)jl_alloc_vec_any(0);
+		for (auto value : key)
+			jl_array_ptr_1d_push((jl_array_t*)types, value);
+		_roots.emplace_back(types);
+
+		types = (jl_value_t*)jl_alloc_vec_any(0);
+		for (auto type : argumentTypes)
+			jl_array_ptr_1d_push((jl_array_t*)types, type);
+		name = Impl::box(functionName);
+		jl_value_t* statement = jl_call3(JULIACPP_HELPER("precompileStatement"), (jl_value_t*)module, name, types);
+		JL_GC_POP();
+
+		if (statement == nullptr || jl_exception_occurred() != nullptr)
+		{
+			jl_exception_clear();
+			return;
+		}
+
+		const std::string line = Impl::unbox<std::string>(statement);
+		if (_statements.insert(line).second)
+			_file << line << std::endl;
+	}
+
+	// Runs every statement in filePath and returns how many succeeded.
+	// Signatures that no longer exist are skipped.
+	size_t replay(const std::string& filePath)
+	{
+		std::set<std::string> statements;
+		readStatements(filePath, statements);
+
+		size_t compiled = 0;
+		for (auto& statement : statements)
+		{
+			jl_value_t* ret = jl_eval_string(statement.c_str());
+			if (jl_exception_occurred() != nullptr)
+			{
+				log("CompileTrace - failed: %s", statement.c_str());
+				jl_exception_clear();
+				continue;
+			}
+
+			if (ret != nullptr && jl_is_bool(ret) && jl_unbox_bool(ret))
+				compiled++;
+		}
+
+		return compiled;
+	}
+
+private:
+	CompileTrace() : _recording(false) { }
+
+	static void readStatements(const std::string& filePath, std::set<std::string>& statements)
+	{
+		std::ifstream file(filePath);
+		std::string line;
+		while (std::getline(file, line))
+		{
+			if (!line.empty())
+				statements.insert(line);
+		}
+	}
+
+	std::atomic<bool> _recording;
+	std::mutex _mutex;
+	std::ofstream _file;
+	std::set<std::pair<std::string, std::vector<jl_value_t*>>> _signatures;
+	std::vector<Impl::RootedValue> _roots;
+	std::set<std::string> _statements;
+};
+
+// A package loaded with `import` instead of a source file. Precompiled
+// packages load their cached native code instead of being parsed and compiled
+// again. loadPath is added to LOAD_PATH and depotPath to the locations
+// searched for compiled caches (DEPOT_PATH or LOAD_CACHE_PATH).
+struct Package
+{
+	explicit Package(const std::string& name, const std::string& loadPath = "", const std::string& depotPath = "")
+		: _name(name), _loadPath(loadPath), _depotPath(depotPath)
+	{
+	}
+
+	std::string _name;
+	std::string _loadPath;
+	std::string _depotPath;
+};
+
+// Eager modules are loaded by the constructor. Lazy modules are loaded on
+// the first call (or ensureLoaded()), so modules that are never used cost no
+// load time or memory.
+enum class LoadPolicy { Eager, Lazy };
+
+class JuliaModule
+{
+public:
+
+	JuliaModule(const Package& package, LoadPolicy loadPolicy = LoadPolicy::Eager)
+		: _package(package), _module(nullptr)
+	{
+		if (loadPolicy == LoadPolicy::Eager)
+			reload();
+	}
+
+	JuliaModule(const std::string& filePath, const std::string& moduleName, LoadPolicy loadPolicy = LoadPolicy::Eager)
+		: _filePath(filePath), _moduleName(moduleName), _module(nullptr)
+	{
+		if (loadPolicy == LoadPolicy::Eager)
+			reload();
+	}
+
+	JuliaModule(const std::string& filePath, LoadPolicy loadPolicy = LoadPolicy::Eager)
+		: _filePath(filePath), _module(jl_current_module)
+	{
+		if (loadPolicy == LoadPolicy::Eager)
+			reload();
+	}
+
+	JuliaModule(jl_module_t* juliaModule)
+		: _module(juliaModule), _loaded(true)
+	{
+	}
+
+	~JuliaModule() { }
+
+	JuliaModule(const JuliaModule&) = default;
+	JuliaModule(JuliaModule&&) = default;
+	JuliaModule& operator=(const JuliaModule&) = default;
+	JuliaModule& operator=(JuliaModule&&) = default;
+
+	void reload()
+	{
+		load(true);
+	}
+
+	// Loads a lazy module if it is not loaded yet. Safe to call from several
+	// threads, the module is loaded only once. If loading fails, the next
+	// call tries again.
+	void ensureLoaded()
+	{
+		loadIfNeeded(true);
+	}
+
+	bool isLoaded() const { return _loaded; }
+
+	// Loads a new version of the file into a separate staging module and
+	// compiles the most called functions there while the current version stays
+	// in use. Only then the module pointer is switched, so calls never see a
+	// partially defined module and the first calls after the switch are warm.
+	// Like every other member function, it must not run concurrently with
+	// calls on the same JuliaModule.
+	void stagedReload(size_t warmupFunctions = 8)
+	{
+		if (!_loaded)
+		{
+			// Nothing is in use yet that a staged version would have to replace
+			ensureLoaded();
+			return;
+		}
+
+		if (_filePath.empty() || !_package._name.empty())
+		{
+			reload();
+			return;
+		}
+
+		Impl::TraceSpan span("load", _filePath + " (staged)");
+		const auto hotFunctions = mostCalledFunctions(warmupFunctions);
+
+		jl_value_t* staging = nullptr;
+		jl_value_t* path = nullptr;
+		JL_GC_PUSH2(&staging, &path);
+
+		path = Impl::box(_filePath);
+		staging = jl_call1(JULIACPP_HELPER("loadStaged"), path);
+
+		jl_module_t* module = (jl_module_t*)staging;
+		if (staging != nullptr && !_moduleName.empty())
+			module = (jl_module_t*)jl_get_global(module, Impl::internSymbol(_moduleName));
+
+		if (jl_exception_occurred() == nullptr && module != nullptr)
+		{
+			for (auto& signature : hotFunctions)
+				precompile(module, signature._functionName, signature._argumentTypes);
+
+			// Rooted before the GC frame is popped, nothing else references the
+			// staging module
+			setModule(module);
+			_functions.clear();
+		}
+
+		JL_GC_POP();
+
+		handleException();
+		JULIACPP_ASSERT(module != nullptr, "Module '" + _moduleName + "' not found.");
+	}
+
+	template<typename... TArgs>
+	IntermediateValue call(const std::string& functionName, TArgs&&... args)
+	{
+		IntermediateValue value { callInternal(functionName, std::forward<TArgs>(args)...) };
+		value._stats = _callStats;
+		return value;
+	}
+
+	template<typename TReturn, typename... TArgs>
+	TReturn call(const std::string& functionName, TArgs&&... args)
+	{
+		jl_value_t* ret = callInternal(functionName, std::forward<TArgs>(args)...);
+		Impl::PhaseTimer timer(callStats(), CallPhase::Unbox);
+		return Impl::unboxValue<TReturn>(ret);
+	}
+
+	// Like call, but errors are returned instead of thrown and nothing is
+	// printed. Julia exceptions are not formatted unless the message is
+	// requested, which keeps calls that fail often cheap.
+	template<typename TReturn, typename... TArgs>
+	CallResult<TReturn> tryCall(const std::string& functionName, TArgs&&... args)
+	{
+		CallResult<TReturn> result;
+		try
+		{
+			jl_value_t* ret = callInternal<false>(functionName, std::forward<TArgs>(args)...);
+			jl_value_t* exception = jl_exception_occurred();
+			if (exception != nullptr)
+			{
+				result.setException(exception);
+				jl_exception_clear();
+				return result;
+			}
+
+			Impl::PhaseTimer timer(callStats(), CallPhase::Unbox);
+			result.setValue(ret);
+		}
+		catch (const JuliaCppException& e)
+		{
+			result.setError(e.what());
+		}
+		return result;
+	}
+
+	struct CallSignature
+	{
+		std::string _functionName;
+		std::vector<jl_value_t*> _argumentTypes;
+		size_t _calls;
+	};
+
+	// Functions with the most calls since the last reload, together with the
+	// argument types of their first positional call
+	std::vector<CallSignature> mostCalledFunctions(size_t count) const
+	{
+		std::vector<CallSignature> signatures;
+		for (auto& kv : _functions)
+		{
+			if (kv.second._calls > 0)
+				signatures.push_back(CallSignature { kv.first, kv.second._argumentTypes, kv.second._calls });
+		}
+
+		std::sort(signatures.begin(), signatures.end(), [](const CallSignature& a, const CallSignature& b) { return a._calls > b._calls; });
+		if (signatures.size() > count)
+			signatures.resize(count);
+
+		return signatures;
+	}
+
+	// Compiles a function for the given argument types without calling it.
+	// Returns false if the function does not exist or cannot be compiled.
+	bool precompile(const std::string& functionName, const std::vector<jl_value_t*>& argumentTypes)
+	{
+		ensureLoaded();
+		return precompile(_module, functionName, argumentTypes);
+	}
+
+	// The method instance generic dispatch selects for the argument types,
+	// nullptr if no method matches or the Julia version is not supported
+	jl_method_instance_t* methodInstance(const std::string& functionName, const std::vector<jl_value_t*>& argumentTypes)
+	{
+		ensureLoaded();
+#ifdef JULIACPP_HAS_DIRECT_INVOKE
+		jl_function_t* func = getFunction(functionName);
+		return func != nullptr ? Impl::methodInstance(func, argumentTypes) : nullptr;
+#else
+		return nullptr;
+#endif
+	}
+
+	// Resolves once which method generic dispatch selects for the types of the
+	// example arguments. Later calls with exactly these argument types invoke
+	// that method directly, calls with other types fall back to generic
+	// dispatch. The method is looked up again when new methods have been
+	// defined since. Returns false if no method matches or the Julia version
+	// does not support direct invocation.
+	template <typename... TArgs>
+	bool specialize(const std::string& functionName, TArgs&&... exampleArgs)
+	{
+		static_assert(Impl::TypeOccurrenceCounter<KeywordArgs, Impl::UnqualifiedType<TArgs>...>::value == 0, "Keyword calls cannot be specialized.");
+
+		ensureLoaded();
+		FunctionEntry* entry = getFunctionEntry(functionName);
+		JULIACPP_ASSERT(entry != nullptr, "Function '" + functionName + "' not found.");
+
+		entry->_specializationTypes.clear();
+		{
+			GcPause gcPause; // the boxed examples are not rooted
+			jl_value_t* values[] = { nullptr, Impl::box(exampleArgs)... };
+			for (size_t i = 1; i < sizeof(values) / sizeof(values[0]); i++)
+				entry->_specializationTypes.push_back(jl_typeof(values[i]));
+			entry->_specializationTypesRoot.reset((jl_value_t*)jl_apply_tuple_type_v(entry->_specializationTypes.data(), entry->_specializationTypes.size()));
+		}
+
+		return resolveSpecialization(*entry);
+	}
+
+	// Number of calls that invoked the method resolved by specialize()
+	size_t getDirectCalls(const std::string& functionName) const
+	{
+		auto it = _functions.find(functionName);
+		return it != _functions.end() ? it->second._directCalls : 0;
+	}
+
+	// Number of calls of a specialized function that fell back to generic
+	// dispatch because the argument types differed
+	size_t getFallbackCalls(const std::string& functionName) const
+	{
+		auto it = _functions.find(functionName);
+		return it != _functions.end() ? it->second._fallbackCalls : 0;
+	}
+
+	const std::string& getFilePath() const { return _filePath; }
+
+private:
+
+	static bool precompile(jl_module_t* module, const std::string& functionName, const std::vector<jl_value_t*>& argumentTypes)
+	{
+		jl_function_t* func = (jl_function_t*)jl_get_global(module, Impl::internSymbol(functionName));
+		if (func == nullptr)
+			return false;
+
+		std::vector<jl_value_t*> types(argumentTypes);
+		jl_value_t* tupleType = (jl_value_t*)jl_apply_tuple_type_v(types.data(), types.size());
+		JL_GC_PUSH1(&tupleType);
+		jl_value_t* ret = jl_call2(jl_get_global(jl_base_module, JULIACPP_SYMBOL("precompile")), func, tupleType);
+		JL_GC_POP();
+
+		if (jl_exception_occurred() != nullptr)
+		{
+			jl_exception_clear();
+			return false;
+		}
+
+		return ret != nullptr && jl_is_bool(ret) && jl_unbox_bool(ret);
+	}
+
+	struct FunctionEntry
+	{
+		jl_function_t* _function;
+		size_t _calls;
+		bool _hasArgumentTypes;
+		std::vector<jl_value_t*> _argumentTypes;
+		Impl::RootedValue _argumentTypesRoot; // Tuple of _argumentTypes, keeps them alive
+		jl_function_t* _kwsorter; // looked up on the first keyword call
+		jl_method_instance_t* _specialization; // see specialize()
+		std::vector<jl_value_t*> _specializationTypes;
+		Impl::RootedValue _specializationTypesRoot; // Tuple of _specializationTypes
+		size_t _specializationWorld;
+		size_t _directCalls;
+		size_t _fallbackCalls;
+		Impl::CallStatsEntry* _stats; // only set with JULIACPP_ENABLE_CALL_STATS
+	};
+
+	Impl::CallStatsEntry* callStats() const { return _callStats; }
+
+	bool resolveSpecialization(FunctionEntry& entry)
+	{
+#ifdef JULIACPP_HAS_DIRECT_INVOKE
+		entry._specialization = Impl::methodInstance(entry._function, entry._specializationTypes);
+		entry._specializationWorld = jl_get_world_counter();
+#else
+		entry._specialization = nullptr;
+#endif
+		return entry._specialization != nullptr;
+	}
+
+	// The method instance resolved by specialize(), if the boxed arguments
+	// have exactly the specialized types
+	jl_method_instance_t* getSpecialization(FunctionEntry& entry)
+	{
+		if (entry._specialization == nullptr)
+			return nullptr;
+
+		bool matches = _argumentList.size() == entry._specializationTypes.size();
+		for (size_t i = 0; matches && i < _argumentList.size(); i++)
+			matches = jl_typeof(_argumentList[i]) == entry._specializationTypes[i];
+
+#ifdef JULIACPP_HAS_DIRECT_INVOKE
+		// New methods may change which one dispatch selects
+		if (matches && entry._specializationWorld != jl_get_world_counter())
+			matches = resolveSpecialization(entry);
+#endif
+
+		if (!matches)
+		{
+			entry._fallbackCalls++;
+			return nullptr;
+		}
+
+		entry._directCalls++;
+		return entry._specialization;
+	}
+
+	// Without throwOnException, Julia exceptions are left pending for the caller
+	template<bool throwOnException = true, typename... TArgs>
+	jl_value_t* callInternal(const std::string& functionName, TArgs&&... args)
+	{
+		static_assert(Impl::HasMaxOne<KeywordArgs, TArgs...>::value, "Only a maximum of one KeywordArgs is allowed.");
+
+		if (!loadIfNeeded(throwOnException))
+			return nullptr;
+
+		FunctionEntry* entry = getFunctionEntry(functionName);
+		JULIACPP_ASSERT(entry != nullptr, "Function '" + functionName + "' not found.");
+		jl_function_t* func = entry->_function;
+
+#ifdef JULIACPP_ENABLE_CALL_STATS
+		if (entry->_stats == nullptr)
+			entry->_stats = Impl::CallStatsRegistry::instance().entry(_moduleName.empty() ? functionName : _moduleName + "." + functionName);
+		_callStats = entry->_stats;
+#endif
+
+		_argumentList.clear();
+		_argumentList.reserve(sizeof...(TArgs));
+		_keywordArgs = nullptr;
+		_keywordSchema = nullptr;
+
+		// The values boxed into a KwSchema are released when the call ends,
+		// also if boxing or the call throws
+		struct KeywordSchemaGuard
+		{
+			const KwSchema*& _schema;
+			~KeywordSchemaGuard()
+			{
+				if (_schema != nullptr)
+					_schema->clearValues();
+			}
+		} keywordSchemaGuard { _keywordSchema };
+
+		Impl::checkHeapGrowth();
+
+		Impl::CallSpan callSpan(callStats());
+		const Impl::GcSnapshot gcBefore = Impl::gcSnapshot(callStats());
+
+		// The boxed arguments are not rooted until jl_call copies them into its
+		// own GC frame, so no collection may run in between
+		GcPause gcPause;
+		{
+			Impl::PhaseTimer timer(callStats(), CallPhase::Box);
+			pushToArgumentList(std::forward<TArgs>(args)...);
+		}
+		callSpan.setArguments(_argumentList.size());
+
+		// Types of the positional arguments, recorded if the call succeeds
+		std::vector<jl_value_t*> tracedTypes;
+		const bool tracing = _keywordArgs == nullptr && CompileTrace::instance().isRecording();
+		if (tracing)
+		{
+			for (auto arg : _argumentList)
+				tracedTypes.push_back(jl_typeof(arg));
+		}
+
+		const bool firstCall = entry->_calls++ == 0;
+		if (!entry->_hasArgumentTypes && _keywordArgs == nullptr)
+		{
+			entry->_argumentTypes.clear();
+			for (auto arg : _argumentList)
+				entry->_argumentTypes.push_back(jl_typeof(arg));
+			entry->_argumentTypesRoot.reset((jl_value_t*)jl_apply_tuple_type_v(entry->_argumentTypes.data(), entry->_argumentTypes.size()));
+			entry->_hasArgumentTypes = true;
+		}
+
+		if (_keywordArgs != nullptr)
+		{
+			if (entry->_kwsorter == nullptr)
+				entry->_kwsorter = jl_gf_mtable(func)->kwsorter;
+			jl_function_t* kwsorter = entry->_kwsorter;
+			JULIACPP_ASSERT(kwsorter != nullptr, "Function '" + functionName + "' does not accept keyword arguments.");
+			// insert original function as second argument
+			_argumentList.insert(_argumentList.begin(), func);
+			// insert keyword arguments array as first argument
+			_argumentList.insert(_argumentList.begin(), _keywordArgs);
+
+			// call kwsorter instead
+			func = kwsorter;
+		}
+
+#ifdef JULIACPP_HAS_DIRECT_INVOKE
+		// Resolved while the GC is still paused since it allocates the tuple type
+		jl_method_instance_t* specialization = _keywordArgs == nullptr ? getSpecialization(*entry) : nullptr;
+#endif
+
+		// The first call of a function includes compiling it
+		auto timer = firstCall ? StartupProfile::instance().start() : StartupProfile::Timer { false, {} };
+
+		jl_value_t* ret;
+		{
+			Impl::FirstCallSpan firstCallSpan(callStats(), firstCall);
+			Impl::PhaseTimer dispatchTimer(callStats(), CallPhase::Dispatch);
+			gcPause.resume();
+#ifdef JULIACPP_HAS_DIRECT_INVOKE
+			if (specialization != nullptr)
+			{
+				ret = Impl::invokeMethodInstance(specialization, func, _argumentList.data(), _argumentList.size());
 			}
 			else
+#endif
+			if (!_argumentList.empty())
 			{
-				JULIACPP_ASSERT(jl_array_eltype(val) == TypeTraits<TElem>::dataType(), "Unexpected jl_array_t element type.");
-				std::memcpy(array.data(), jlArray->data, sizeof(TElem) * size);
+				const int32_t nargs = (int32_t)_argumentList.size();
+				ret = jl_call(func, _argumentList.data(), nargs);
+			}
+			else
+			{
+				ret = jl_call0(func);
 			}
 		}
-	} // namespace RefUnboxer
 
+		if (tracing && ret != nullptr)
+		{
+			// Recording allocates, and nothing else references the result yet
+			JL_GC_PUSH1(&ret);
+			CompileTrace::instance().record(_module, functionName, tracedTypes);
+			JL_GC_POP();
+		}
 
-	template<typename... TReturns>
-	inline typename Unboxer::ValueUnboxer<TReturns...>::type unboxValue(jl_value_t* value)
+		StartupProfile::instance().stop(timer, StartupPhase::Kind::FirstCall, functionName);
+		Impl::recordGc(callStats(), gcBefore);
+
+		Impl::PhaseTimer exceptionTimer(callStats(), CallPhase::Exception);
+		if (throwOnException)
+			handleException();
+
+		return ret;
+	}
+
+	// Without throwOnException, a Julia exception thrown while loading is left
+	// pending and false is returned
+	bool load(bool throwOnException)
 	{
-		return Unboxer::ValueUnboxer<TReturns...>::apply(value);
+		// Functions of the previous module version must not be called anymore
+		_functions.clear();
+
+		if (!_package._name.empty())
+		{
+			Impl::TraceSpan span("load", _package._name);
+			auto timer = StartupProfile::instance().start();
+			jl_module_t* module = loadPackage(_package, throwOnException);
+			StartupProfile::instance().stop(timer, StartupPhase::Kind::Load, _package._name);
+			if (module == nullptr)
+				return false;
+
+			setModule(module);
+			_loaded = true;
+			return true;
+		}
+
+		if (_filePath.empty())
+		{
+			_loaded = true;
+			return true;
+		}
+
+		Impl::TraceSpan span("load", _filePath);
+		auto timer = StartupProfile::instance().start();
+		volatile bool failed = false;
+		JL_TRY
+		{
+			loadFile(_filePath);
+			if (!_moduleName.empty())
+				_module = loadModule(_moduleName);
+		}
+		JL_CATCH
+		{
+			failed = true;
+		}
+		StartupProfile::instance().stop(timer, StartupPhase::Kind::Load, _filePath);
+
+		if (failed)
+		{
+			if (!throwOnException)
+				return false;
+			handleException();
+		}
+
+		JULIACPP_ASSERT(_moduleName.empty() || _module != nullptr, "Module '" + _moduleName + "' not found.");
+		setModule(_module);
+		_loaded = true;
+		return true;
+	}
+
+	bool loadIfNeeded(bool throwOnException)
+	{
+		if (_loaded)
+			return true;
+
+		std::lock_guard<std::mutex> lock(Impl::loadMutex());
+		return _loaded || load(throwOnException);
+	}
+
+	void setModule(jl_module_t* module)
+	{
+		_module = module;
+		_moduleRoot.reset((jl_value_t*)module);
+	}
+
+	static inline void loadFile(const std::string& file)
+	{
+		jl_load(file.c_str());
+	}
+
+	static inline jl_module_t* loadModule(const std::string& module)
+	{
+		return (jl_module_t*)jl_get_global(jl_current_module, Impl::internSymbol(module));
+	}
+
+	// Returns nullptr if a Julia exception is left pending (without throwOnException)
+	static inline jl_module_t* loadPackage(const Package& package, bool throwOnException)
+	{
+		jl_value_t* loadPath = nullptr;
+		jl_value_t* depotPath = nullptr;
+		JL_GC_PUSH2(&loadPath, &depotPath);
+		loadPath = Impl::box(package._loadPath);
+		depotPath = Impl::box(package._depotPath);
+		jl_call2(JULIACPP_HELPER("addPackagePaths"), loadPath, depotPath);
+		JL_GC_POP();
+		if (!throwOnException && jl_exception_occurred() != nullptr)
+			return nullptr;
+		handleException();
+
+		jl_value_t* module = jl_call1(JULIACPP_HELPER("requirePackage"), Impl::box(package._name));
+		if (!throwOnException && jl_exception_occurred() != nullptr)
+			return nullptr;
+		handleException();
+		JULIACPP_ASSERT(module != nullptr && jl_is_module(module), "Package '" + package._name + "' not found.");
+		return (jl_module_t*)module;
+	}
+
+	inline jl_function_t* getFunction(const std::string& functionName)
+	{
+		FunctionEntry* entry = getFunctionEntry(functionName);
+		return entry != nullptr ? entry->_function : nullptr;
 	}
 
+	// Function handles are cached until the next reload
+	FunctionEntry* getFunctionEntry(const std::string& functionName)
+	{
+		auto it = _functions.find(functionName);
+		if (it != _functions.end())
+			return &it->second;
+
+		jl_function_t* func = (jl_function_t*)jl_get_global(_module, Impl::internSymbol(functionName));
+		if (func == nullptr)
+			return nullptr;
+
+		FunctionEntry& entry = _functions[functionName];
+		entry._function = func;
+		return &entry;
+	}
+
+
+	void pushToArgumentList() { }
+
 	template<typename T>
-	inline void unboxValueByRef(jl_value_t* val, std::tuple<T&>& returns)
+	void pushToArgumentList(T&& value)
 	{
-		RefUnboxer::RefValueUnboxer<T>::apply(val, std::get<0>(returns));
+		jl_value_t* val = Impl::box(value);
+		JULIACPP_ASSERT_NOMSG(val != nullptr);
+		_argumentList.push_back(val);
 	}
 
-	template<typename... TReturns>
-	inline void unboxValueByRef(jl_value_t* val, std::tuple<TReturns&...>& returns)
+	void pushToArgumentList(KeywordArgs&& keywordArgs)
 	{
-		RefUnboxer::RefValueUnboxer<TReturns...>::apply(val, returns);
+		JULIACPP_ASSERT(_keywordArgs == nullptr, "Only a maximum of one set of keyword arguments is allowed.");
+		_keywordArgs = Impl::boxKeywordArgs(keywordArgs);
 	}
-} // namespace Impl
 
+	template<typename... T>
+	void pushToArgumentList(KwValues<T...>&& keywordValues)
+	{
+		JULIACPP_ASSERT(_keywordArgs == nullptr, "Only a maximum of one set of keyword arguments is allowed.");
+		_keywordSchema = &keywordValues._schema; // set first so that partially boxed values are cleared too
+		_keywordArgs = keywordValues.box();
+	}
 
-inline void initJulia()
-{
-	jl_init(nullptr);
-}
+	template<typename T, typename... TArgs>
+	void pushToArgumentList(T&& value, TArgs&&...  values)
+	{
+		pushToArgumentList(std::forward<T>(value));
+		pushToArgumentList(std::forward<TArgs>(values)...);
+	}
 
-inline void initJulia(const std::string& homeDir)
-{
-	jl_init(homeDir.c_str());
-}
+	static inline void handleException()
+	{
+		auto exception = jl_exception_occurred();
+		if (exception != nullptr)
+		{
+			const std::string exceptionType(jl_typeof_str(exception));
 
-inline void shutdownJulia(int status = 0)
+			jl_printf(JL_STDERR, "Julia ERROR: ");
+			jl_value_t* args[2] = { jl_stderr_obj(), exception };
+			jl_function_t* showerror_func = (jl_function_t*)jl_get_global(jl_base_module, JULIACPP_SYMBOL("showerror"));
+			JULIACPP_ASSERT_NOMSG(showerror_func != nullptr);
+			jl_call(showerror_func, args, 2);
+			jl_printf(JL_STDERR, "\n");
+
+			JULIACPP_ASSERT(exception == nullptr, exceptionType);
+		}
+	}
+
+private:
+	std::string _filePath;
+	std::string _moduleName;
+	Package _package { "" };
+	jl_module_t* _module;
+	Impl::RootedValue _moduleRoot; // staged modules are only referenced from here
+	Impl::CopyableAtomic<bool> _loaded;
+
+	std::vector<jl_value_t*> _argumentList;
+	jl_value_t* _keywordArgs;
+	const KwSchema* _keywordSchema;
+
+	std::unordered_map<std::string, FunctionEntry> _functions;
+	Impl::CallStatsEntry* _callStats = nullptr; // stays null without JULIACPP_ENABLE_CALL_STATS
+};
+
+namespace Impl
 {
-	jl_atexit_hook(status);
+	// Address unique to a list of C++ argument types, compared without RTTI
+	template <typename... TArgs>
+	inline const void* signatureId()
+	{
+		static const char id = 0;
+		return &id;
+	}
 }
 
-struct IntermediateValue
+// Calls with bounded latency for a fixed set of signatures. Signatures are
+// registered and compiled up front. Inside a window (begin() to end(), or a
+// Window scope) the garbage collector is disabled, and it runs once when the
+// window ends. Calls with an unregistered signature, and calls that still
+// trigger JIT compilation, are counted and reported to the violation
+// callback instead of failing.
+//
+// JIT is detected by checking whether the method instance of a registered
+// signature has machine code before it is called, which requires Julia 0.6.
+// Julia 0.6 only emits machine code on the first call, so call each
+// registered function once outside a window to keep windows free of JIT.
+// Keep return values in preallocated buffers with noAlloc/tieNoAlloc to avoid
+// allocating on the C++ side as well.
+class RealtimeCalls
 {
-	IntermediateValue() = default;
-	IntermediateValue(jl_value_t* jlvalue) : _jlvalue(jlvalue) { };
+public:
+	struct Violation
+	{
+		enum class Kind { Unregistered, Compiled };
+
+		Kind _kind;
+		std::string _functionName;
+		double _seconds; // for Kind::Compiled, duration of the call including JIT
+	};
+
+	class Window
+	{
+	public:
+		explicit Window(RealtimeCalls& calls) : _calls(calls) { _calls.begin(); }
+		~Window() { _calls.end(); }
+
+		Window(const Window&) = delete;
+		Window& operator=(const Window&) = delete;
+
+	private:
+		RealtimeCalls& _calls;
+	};
+
+	explicit RealtimeCalls(JuliaModule& module, GcCollection collection = GcCollection::Incremental)
+		: _module(module), _collection(collection), _unregisteredCalls(0), _compiledCalls(0)
+	{
+#ifndef JULIACPP_HAS_DIRECT_INVOKE
+		JULIACPP_ASSERT(false, "RealtimeCalls cannot detect JIT compilation with this Julia version.");
+#endif
+	}
+
+	// Registers the signature of the given example arguments and compiles it.
+	// The arguments are only boxed to determine their Julia types.
+	template <typename... TArgs>
+	void add(const std::string& functionName, TArgs&&... exampleArgs)
+	{
+		static_assert(Impl::TypeOccurrenceCounter<KeywordArgs, Impl::UnqualifiedType<TArgs>...>::value == 0, "Keyword calls cannot be registered.");
+
+		std::vector<jl_value_t*> types;
+		{
+			GcPause gcPause; // the boxed examples are not rooted
+			jl_value_t* values[] = { nullptr, Impl::box(exampleArgs)... };
+			for (size_t i = 1; i < sizeof(values) / sizeof(values[0]); i++)
+				types.push_back(jl_typeof(values[i]));
+		}
+
+		JULIACPP_ASSERT(_module.precompile(functionName, types), "Could not compile '" + functionName + "' for the registered signature.");
+
+		Signature signature;
+		signature._id = Impl::signatureId<Impl::UnqualifiedType<TArgs>...>();
+		signature._types = types;
+		signature._typesRoot.reset((jl_value_t*)jl_apply_tuple_type_v(types.data(), types.size()));
+		signature._instance = nullptr;
+		signature._world = 0;
+		isCompiled(functionName, signature); // resolves the method instance
+		_signatures[functionName].push_back(std::move(signature));
+	}
+
+	template <typename... TArgs>
+	bool isRegistered(const std::string& functionName) const
+	{
+		return findSignature<TArgs...>(functionName) != nullptr;
+	}
+
+	// Whether calling a registered signature runs without JIT compilation
+	template <typename... TArgs>
+	bool isCompiled(const std::string& functionName)
+	{
+		const Signature* signature = findSignature<TArgs...>(functionName);
+		return signature != nullptr && isCompiled(functionName, *signature);
+	}
 
-	jl_value_t* _jlvalue;
+	void begin()
+	{
+		JULIACPP_ASSERT(!_gcPause, "Realtime window is already active.");
+		_gcPause.reset(new GcPause());
+	}
 
-	template <typename T>
-	inline operator T()
+	// Ends the window and runs the collection that was held back
+	void end()
 	{
-		return Impl::Unboxer::ValueUnboxer<T>::apply(_jlvalue);
+		if (!_gcPause)
+			return;
+
+		_gcPause.reset();
+		collectNow(_collection);
 	}
 
-	inline jl_value_t* getJuliaValue() { return _jlvalue; }
-};
+	bool isActive() const { return (bool)_gcPause; }
 
-template <typename T>
-inline T unboxJuliaValue(jl_value_t* value)
-{
-	return Impl::unboxValue<T>(value);
-}
+	template <typename... TArgs>
+	IntermediateValue call(const std::string& functionName, TArgs&&... args)
+	{
+		const Signature* signature = findSignature<TArgs...>(functionName);
+		if (signature == nullptr)
+		{
+			report(Violation { Violation::Kind::Unregistered, functionName, 0.0 });
+			return _module.call(functionName, std::forward<TArgs>(args)...);
+		}
 
-inline IntermediateValue unboxJuliaValue(jl_value_t* value)
-{
-	return IntermediateValue(value);
-}
+		if (isCompiled(functionName, *signature))
+			return _module.call(functionName, std::forward<TArgs>(args)...);
 
-template <typename... T>
-class Tuple
-{
-public:
-	Tuple(T&... args) : _tuple(args...) {}
+		const auto start = std::chrono::steady_clock::now();
+		IntermediateValue value = _module.call(functionName, std::forward<TArgs>(args)...);
+		report(Violation { Violation::Kind::Compiled, functionName, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() });
+		return value;
+	}
 
-	void operator=(IntermediateValue&& value)
+	template <typename TReturn, typename... TArgs>
+	TReturn call(const std::string& functionName, TArgs&&... args)
 	{
-		_tuple = Impl::unboxValue<typename std::remove_reference<T>::type...>(value._jlvalue);
+		IntermediateValue value = call(functionName, std::forward<TArgs>(args)...);
+		return Impl::unboxValue<TReturn>(value._jlvalue);
 	}
 
+	void onViolation(std::function<void(const Violation&)> callback) { _onViolation = std::move(callback); }
+
+	size_t getUnregisteredCalls() const { return _unregisteredCalls; }
+	size_t getCompiledCalls() const { return _compiledCalls; }
+
 private:
-	std::tuple<T&...> _tuple;
-};
+	struct Signature
+	{
+		const void* _id; // see Impl::signatureId
+		std::vector<jl_value_t*> _types;
+		Impl::RootedValue _typesRoot; // Tuple of _types
+		mutable jl_method_instance_t* _instance; // resolved when registered
+		mutable size_t _world;                   // in which _instance was resolved
+	};
 
-template <typename... T>
-Tuple<T&...> tie(T&... args)
-{
-	return Tuple<T&...>(args...);
-}
+	template <typename... TArgs>
+	const Signature* findSignature(const std::string& functionName) const
+	{
+		auto it = _signatures.find(functionName);
+		if (it == _signatures.end())
+			return nullptr;
 
-template <typename... T>
-struct TupleNoAlloc
-{
-public:
-	TupleNoAlloc(T&... args) : _tuple(args...) {}
+		const void* id = Impl::signatureId<Impl::UnqualifiedType<TArgs>...>();
+		for (auto& signature : it->second)
+		{
+			if (signature._id == id)
+				return &signature;
+		}
+		return nullptr;
+	}
 
-	void operator=(IntermediateValue&& value)
+	bool isCompiled(const std::string& functionName, const Signature& signature)
 	{
-		Impl::unboxValueByRef<typename std::remove_reference<T>::type...>(value._jlvalue, _tuple);
+#ifdef JULIACPP_HAS_DIRECT_INVOKE
+		// Reloads and new methods may change which method is called
+		const size_t world = jl_get_world_counter();
+		if (signature._instance == nullptr || signature._world != world)
+		{
+			signature._instance = _module.methodInstance(functionName, signature._types);
+			signature._world = world;
+		}
+		return signature._instance != nullptr && Impl::isCompiled(signature._instance);
+#else
+		return false;
+#endif
 	}
 
-private:
-	std::tuple<T&...> _tuple;
+	void report(const Violation& violation)
+	{
+		if (violation._kind == Violation::Kind::Unregistered)
+			_unregisteredCalls++;
+		else
+			_compiledCalls++;
+
+		if (_onViolation)
+			_onViolation(violation);
+	}
+
+	JuliaModule& _module;
+	GcCollection _collection;
+	std::unordered_map<std::string, std::vector<Signature>> _signatures;
+	std::unique_ptr<GcPause> _gcPause;
+	std::function<void(const Violation&)> _onViolation;
+	size_t _unregisteredCalls;
+	size_t _compiledCalls;
 };
 
-template <typename... T>
-TupleNoAlloc<T&...> tieNoAlloc(T&... args)
+// Process-wide set of shared JuliaModules keyed by (file path, module name).
+// Each file is loaded once no matter how many components ask for it, and
+// reloading a registered module updates every handle at once.
+class ModuleRegistry
 {
-	return TupleNoAlloc<T&...>(args...);
-}
+public:
 
-template <typename T>
-TupleNoAlloc<T&> noAlloc(T& arg)
-{
-	return TupleNoAlloc<T&>(arg);
-}
+	static ModuleRegistry& instance()
+	{
+		static ModuleRegistry registry;
+		return registry;
+	}
 
-struct KeywordArgs
-{
-	template <typename T>
-	KeywordArgs(const std::string& key, T&& value)
+	std::shared_ptr<JuliaModule> get(const std::string& filePath, const std::string& moduleName = "")
 	{
-		_map[key] = Impl::box(std::forward<T>(value));
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		const Key key(canonicalPath(filePath), moduleName);
+		auto it = _modules.find(key);
+		if (it != _modules.end())
+			return it->second;
+
+		auto module = moduleName.empty() ? std::make_shared<JuliaModule>(filePath) : std::make_shared<JuliaModule>(filePath, moduleName);
+		_modules[key] = module;
+		return module;
 	}
 
-	template <typename T>
-	KeywordArgs&& operator()(const std::string& key, T&& value) &&
+	bool contains(const std::string& filePath, const std::string& moduleName = "")
 	{
-		_map[key] = Impl::box(std::forward<T>(value));
-		return std::move(*this);
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _modules.count(Key(canonicalPath(filePath), moduleName)) != 0;
 	}
 
-	std::map<std::string, jl_value_t*> _map;
-};
+	void reload(const std::string& filePath, const std::string& moduleName = "")
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
 
-namespace Impl
-{
-	static jl_value_t* boxKeywordArgs(const KeywordArgs& keywordArgs)
+		auto it = _modules.find(Key(canonicalPath(filePath), moduleName));
+		JULIACPP_ASSERT(it != _modules.end(), "Module '" + moduleName + "' from '" + filePath + "' is not registered.");
+		it->second->reload();
+	}
+
+	void reloadAll()
 	{
-		const size_t numArgs = keywordArgs._map.size();
-		jl_datatype_t* dataType = jl_any_type;
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto& kv : _modules)
+			kv.second->reload();
+	}
 
-		jl_value_t* arrayType = jl_apply_array_type(dataType, 1);
-		jl_array_t* array = jl_alloc_array_1d(arrayType, numArgs * 2);
+	// Drops the registry's references. Existing handles stay valid.
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_modules.clear();
+	}
 
-		jl_value_t** arrayData = (jl_value_t**)jl_array_data(array);
-		size_t i = 0;
-		for(auto& kv : keywordArgs._map)
-		{
-			arrayData[i] = (jl_value_t*)jl_symbol(kv.first.c_str());
-			arrayData[i+1] = kv.second;
+private:
+	typedef std::pair<std::string, std::string> Key;
 
-			i += 2;
-		}
+	ModuleRegistry() = default;
+	ModuleRegistry(const ModuleRegistry&) = delete;
+	ModuleRegistry& operator=(const ModuleRegistry&) = delete;
 
-		return (jl_value_t*)array;
+	static std::string canonicalPath(const std::string& filePath)
+	{
+#ifndef _WIN32
+		std::unique_ptr<char, decltype(&std::free)> path(realpath(filePath.c_str(), nullptr), &std::free);
+		if (path)
+			return path.get();
+#endif
+		return filePath;
 	}
+
+	std::map<Key, std::shared_ptr<JuliaModule>> _modules;
+	std::mutex _mutex;
+};
+
+inline std::shared_ptr<JuliaModule> sharedModule(const std::string& filePath, const std::string& moduleName = "")
+{
+	return ModuleRegistry::instance().get(filePath, moduleName);
 }
 
-class JuliaModule
+// Runs Julia on a dedicated thread. Julia must only be called from the
+// thread that initialized it, so init, every submitted task and shutdown run
+// on that thread, and results are returned as futures. ready() becomes ready
+// once init has finished (or holds the exception it threw).
+class JuliaExecutor
 {
 public:
 
-	JuliaModule(const std::string& filePath, const std::string& moduleName)
-		: _filePath(filePath), _moduleName(moduleName)
+	JuliaExecutor(std::function<void()> init, std::function<void()> shutdown = nullptr)
+		: _ready(_readyPromise.get_future().share()), _stopping(false)
 	{
-		reload();
+		_thread = std::thread(&JuliaExecutor::run, this, std::move(init), std::move(shutdown));
 	}
 
-	JuliaModule(const std::string& filePath)
-		: _filePath(filePath), _module(jl_current_module)
+	~JuliaExecutor()
 	{
-		reload();
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_condition.notify_one();
+		_thread.join();
 	}
 
-	JuliaModule(jl_module_t* juliaModule)
-		: _module(juliaModule)
+	JuliaExecutor(const JuliaExecutor&) = delete;
+	JuliaExecutor& operator=(const JuliaExecutor&) = delete;
+
+	const std::shared_future<void>& ready() const { return _ready; }
+
+	// Tasks run in submission order after init. If init fails, tasks are not
+	// run and their futures hold the exception of init instead.
+	template <typename TFunc>
+	std::future<typename std::result_of<TFunc()>::type> submit(TFunc&& func)
 	{
-	}
+		typedef typename std::result_of<TFunc()>::type TResult;
+		typedef typename std::decay<TFunc>::type TStored;
 
-	~JuliaModule() { }
+		TStored stored(std::forward<TFunc>(func));
+		auto task = std::make_shared<std::packaged_task<TResult()>>([this, stored]() mutable -> TResult
+		{
+			// Only written by the executor thread before it runs tasks
+			if (_initError != nullptr)
+				std::rethrow_exception(_initError);
+			return stored();
+		});
+		auto future = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			JULIACPP_ASSERT(!_stopping, "JuliaExecutor is shutting down.");
+			JULIACPP_ASSERT(_initError == nullptr, "JuliaExecutor failed to initialize Julia.");
+			_tasks.push_back([task] { (*task)(); });
+		}
+		_condition.notify_one();
+		return future;
+	}
 
-	JuliaModule(const JuliaModule&) = default;
-	JuliaModule(JuliaModule&&) = default;
-	JuliaModule& operator=(const JuliaModule&) = default;
-	JuliaModule& operator=(JuliaModule&&) = default;
+private:
 
-	void reload()
+	void run(std::function<void()> init, std::function<void()> shutdown)
 	{
-		if (_filePath.empty())
-			return;
-
-		JL_TRY
+		bool initialized = false;
+		try
+		{
+			init();
+			initialized = true;
+			_readyPromise.set_value();
+		}
+		catch (...)
 		{
-			loadFile(_filePath);
-			if (!_moduleName.empty())
 			{
-				_module = loadModule(_moduleName);
-				JULIACPP_ASSERT(_module != nullptr, "Module '" + _moduleName + "' not found.");
+				std::lock_guard<std::mutex> lock(_mutex);
+				_initError = std::current_exception();
 			}
+			_readyPromise.set_exception(_initError);
 		}
-		JL_CATCH
+
+		for (;;)
 		{
-			handleException();
-			jl_exception_clear();
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_condition.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+				if (_tasks.empty())
+					break;
+
+				task = std::move(_tasks.front());
+				_tasks.pop_front();
+			}
+			task();
 		}
-	}
 
-	template<typename... TArgs>
-	IntermediateValue call(const std::string& functionName, TArgs&&... args)
-	{
-		return IntermediateValue { callInternal(functionName, std::forward<TArgs>(args)...) };
+		if (initialized && shutdown)
+			shutdown();
 	}
 
-	template<typename TReturn, typename... TArgs>
-	TReturn call(const std::string& functionName, TArgs&&... args)
-	{
-		jl_value_t* ret = callInternal(functionName, std::forward<TArgs>(args)...);
-		return Impl::unboxValue<TReturn>(ret);
-	}
+	std::promise<void> _readyPromise;
+	std::shared_future<void> _ready;
 
-private:
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	std::deque<std::function<void()>> _tasks;
+	bool _stopping;
+	std::exception_ptr _initError;
 
-	template<typename... TArgs>
-	jl_value_t* callInternal(const std::string& functionName, TArgs&&... args)
+	std::thread _thread;
+};
+
+struct ModuleFile
+{
+	std::string _filePath;
+	std::string _moduleName;
+};
+
+// Starts Julia and loads the given modules into the ModuleRegistry on a new
+// thread, so that the rest of the program can start up in parallel. Calls
+// into Julia must then be submitted to the returned executor, e.g.
+//   executor->submit([] { return sharedModule("file.jl", "Mod")->call<double>("f", 2.0); })
+// Julia is shut down when the executor is destroyed.
+inline std::unique_ptr<JuliaExecutor> initJuliaAsync(const InitOptions& options, const std::vector<ModuleFile>& modules = {})
+{
+	auto init = [options, modules]
 	{
-		static_assert(Impl::HasMaxOne<KeywordArgs, TArgs...>::value, "Only a maximum of one KeywordArgs is allowed.");
+		initJulia(options);
 
-		jl_function_t* func = getFunction(functionName);
-		JULIACPP_ASSERT(func != nullptr, "Function '" + functionName + "' not found.");
+		for (auto& module : modules)
+			sharedModule(module._filePath, module._moduleName);
+	};
 
-		_argumentList.clear();
-		_argumentList.reserve(sizeof...(TArgs));
-		_keywordArgs = nullptr;
+	auto shutdown = []
+	{
+		ModuleRegistry::instance().clear();
+		shutdownJulia();
+	};
 
-		pushToArgumentList(std::forward<TArgs>(args)...);
+	return std::unique_ptr<JuliaExecutor>(new JuliaExecutor(init, shutdown));
+}
 
-		if (_keywordArgs != nullptr)
-		{
-			jl_function_t* kwsorter = jl_gf_mtable(func)->kwsorter;
-			JULIACPP_ASSERT(kwsorter != nullptr, "Function '" + functionName + "' does not accept keyword arguments.");
-			// insert original function as second argument
-			_argumentList.insert(_argumentList.begin(), func);
-			// insert keyword arguments array as first argument
-			_argumentList.insert(_argumentList.begin(), _keywordArgs);
+inline std::unique_ptr<JuliaExecutor> initJuliaAsync(const std::string& homeDir = "", const std::vector<ModuleFile>& modules = {})
+{
+	InitOptions options;
+	options._homeDir = homeDir;
+	return initJuliaAsync(options, modules);
+}
 
-			// call kwsorter instead
-			func = kwsorter;
-		}
+#if defined(JULIACPP_ENABLE_HOT_RELOAD) && defined(__linux__)
+// Watches the file of a JuliaModule and the files it includes with inotify,
+// and reloads the module only when their contents change. The new version is
+// loaded with JuliaModule::stagedReload, so the most called functions are
+// compiled again before the switch and the next calls do not pay the JIT
+// cost. Cached function handles are dropped by the reload.
+//
+// poll() does not block and must be called from the thread that calls into
+// Julia, e.g. once per iteration of a request loop.
+class HotReloader
+{
+public:
 
-		jl_value_t* ret;
-		if (!_argumentList.empty())
-		{
-			const int32_t nargs = (int32_t)_argumentList.size();
-			ret = jl_call(func, _argumentList.data(), nargs);
-		}
-		else
-		{
-			ret = jl_call0(func);
-		}
+	HotReloader(JuliaModule& module, size_t warmupFunctions = 8)
+		: _module(module), _warmupFunctions(warmupFunctions)
+	{
+		JULIACPP_ASSERT(!module.getFilePath().empty(), "HotReloader requires a module loaded from a file.");
 
-		handleException();
+		_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		JULIACPP_ASSERT(_fd >= 0, "inotify_init1 failed.");
 
-		return ret;
+		_hashes = hashFiles();
+		watchDirectories();
 	}
 
-	static inline void loadFile(const std::string& file)
+	~HotReloader()
 	{
-		jl_load(file.c_str());
+		close(_fd);
 	}
 
-	static inline jl_module_t* loadModule(const std::string& module)
+	HotReloader(const HotReloader&) = delete;
+	HotReloader& operator=(const HotReloader&) = delete;
+
+	// Returns true if the module was reloaded
+	bool poll()
 	{
-		return (jl_module_t*)jl_get_global(jl_current_module, jl_symbol(module.c_str()));
+		if (!readEvents())
+			return false;
+
+		auto hashes = hashFiles();
+		if (hashes == _hashes)
+			return false;
+
+		log("HotReloader - reloading '%s'", _module.getFilePath().c_str());
+
+		_module.stagedReload(_warmupFunctions);
+
+		_hashes = std::move(hashes);
+		watchDirectories();
+		return true;
 	}
 
-	inline jl_function_t* getFunction(const std::string& functionName)
+	// All files watched for changes: the module file and its includes
+	std::vector<std::string> getFiles() const
 	{
-		return jl_get_function(_module, functionName.c_str());
+		std::vector<std::string> files;
+		for (auto& kv : _hashes)
+			files.push_back(kv.first);
+		return files;
 	}
 
+private:
 
-	void pushToArgumentList() { }
-
-	template<typename T>
-	void pushToArgumentList(T&& value)
+	// Returns true if any event was read. Directories are watched instead of
+	// files, because editors often replace a file instead of writing to it.
+	bool readEvents()
 	{
-		jl_value_t* val = Impl::box(value);
-		JULIACPP_ASSERT_NOMSG(val != nullptr);
-		_argumentList.push_back(val);
+		alignas(inotify_event) char buffer[4096];
+		bool hasEvents = false;
+		for (;;)
+		{
+			const ssize_t len = read(_fd, buffer, sizeof(buffer));
+			if (len <= 0)
+			{
+				JULIACPP_ASSERT(len == 0 || errno == EAGAIN || errno == EINTR, "Reading inotify events failed.");
+				return hasEvents;
+			}
+			hasEvents = true;
+		}
 	}
 
-	void pushToArgumentList(KeywordArgs&& keywordArgs)
+	void watchDirectories()
 	{
-		_keywordArgs = Impl::boxKeywordArgs(keywordArgs);
+		for (auto& kv : _hashes)
+		{
+			const std::string directory = directoryOf(kv.first);
+			if (_directories.insert(directory).second)
+				inotify_add_watch(_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+		}
 	}
 
-	template<typename T, typename... TArgs>
-	void pushToArgumentList(T&& value, TArgs&&...  values)
+	// Content hash of the module file and, recursively, of every file it includes
+	std::map<std::string, uint64_t> hashFiles() const
 	{
-		pushToArgumentList(std::forward<T>(value));
-		pushToArgumentList(std::forward<TArgs>(values)...);
+		std::map<std::string, uint64_t> hashes;
+		hashFile(_module.getFilePath(), hashes);
+		return hashes;
 	}
 
-	static inline void handleException()
+	static void hashFile(const std::string& filePath, std::map<std::string, uint64_t>& hashes)
 	{
-		auto exception = jl_exception_occurred();
-		if (exception != nullptr)
-		{
-			const std::string exceptionType(jl_typeof_str(exception));
+		if (hashes.count(filePath))
+			return;
 
-			jl_printf(JL_STDERR, "Julia ERROR: ");
-			jl_value_t* args[2] = { jl_stderr_obj(), exception };
-			jl_function_t* showerror_func = jl_get_function(jl_base_module, "showerror");
-			JULIACPP_ASSERT_NOMSG(showerror_func != nullptr);
-			jl_call(showerror_func, args, 2);
-			jl_printf(JL_STDERR, "\n");
+		std::ifstream file(filePath, std::ios::binary);
+		const std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 
-			JULIACPP_ASSERT(exception == nullptr, exceptionType);
+		// FNV-1a
+		uint64_t hash = 14695981039346656037ull;
+		for (unsigned char c : content)
+			hash = (hash ^ c) * 1099511628211ull;
+		hashes[filePath] = hash;
+
+		static const std::regex includePattern("include\\(\\s*\"([^\"]+)\"\\s*\\)");
+		for (std::sregex_iterator it(content.begin(), content.end(), includePattern), end; it != end; ++it)
+		{
+			const std::string included = (*it)[1];
+			hashFile(included[0] == '/' ? included : directoryOf(filePath) + "/" + included, hashes);
 		}
 	}
 
-private:
-	std::string _filePath;
-	std::string _moduleName;
-	jl_module_t* _module;
+	static std::string directoryOf(const std::string& filePath)
+	{
+		const auto pos = filePath.find_last_of('/');
+		if (pos == std::string::npos)
+			return ".";
+		return pos == 0 ? "/" : filePath.substr(0, pos);
+	}
 
-	std::vector<jl_value_t*> _argumentList;
-	jl_value_t* _keywordArgs;
+	JuliaModule& _module;
+	size_t _warmupFunctions;
+	int _fd;
+	std::map<std::string, uint64_t> _hashes;
+	std::set<std::string> _directories;
 };
+#endif
 
 } // namespace jlcpp
@@ -0,0 +1,9 @@
+__precompile__()
+
+module JuliaCppTestPackage
+
+function packageFunction(val)
+  2val
+end
+
+end
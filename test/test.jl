@@ -31,14 +31,40 @@ function getArrayOfArrays2()
   return Array[[2,2],[1,2,4]]
 end
 
+isBitVectorArray(val) = isa(val, Vector{BitVector})
+
 function getArray()
   return [23,45,67]
 end
 
+function getAnyArray()
+  return Any[1.5, 2.5, -3.5]
+end
+
+function getBoolArray()
+  return Bool[true, false, true]
+end
+
 function getMultiReturn()
   return Int32(24), "tester", Float64[233.23, 2323.424221231, -2.232], Array[Array[[2],[1,4,-9]],Array[Int64[],[2,4]]]
 end
 
+function allocateArrays(n)
+  total = 0
+  for i in 1:n
+    total += length(zeros(100))
+  end
+  return total
+end
+
+function collectGarbage()
+  if VERSION < v"0.7.0-"
+    gc()
+  else
+    GC.gc()
+  end
+end
+
 function errorFunction()
   error("error")
 end
@@ -51,4 +77,11 @@ function keywordArgsFunction(arg1, arg2; named1::Bool=false, named2="default")
   return arg1, arg2, named1, named2
 end
 
+# Only called by the realtime test, so its first call compiles it
+realtimeFunction(x::Int16) = x + Int16(1)
+
+function typedKeywordsFunction(; scale::Float32=1.0f0, offset::Int8=Int8(0))
+  return scale, offset
+end
+
 end
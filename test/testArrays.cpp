@@ -198,3 +198,132 @@ TEST_CASE("Array constness for nested arrays")
 			REQUIRE(std::equal(std::begin(arrayOfArrays[i]), std::end(arrayOfArrays[i]), std::begin(arrayOfArraysCopy[i])));
 	}
 }
+
+TEST_CASE("Ragged arrays")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+
+	RaggedArray<int64_t> rows;
+	rows.append(std::vector<int64_t> {2, 2});
+	rows.append(std::vector<int64_t> {1, 2, 4});
+	const RaggedArray<int64_t> expected(rows);
+
+	{
+		RaggedArray<int64_t> ragged = module.call("getArrayOfArrays2");
+		REQUIRE(ragged == expected);
+		REQUIRE(ragged.size() == 2);
+		REQUIRE(ragged[1] == (std::vector<int64_t> {1, 2, 4}));
+	}
+
+	{
+		RaggedArray<int64_t> ragged = module.call("roundtrip", expected);
+		REQUIRE(ragged == expected);
+	}
+
+	{
+		RaggedArray<int64_t> ragged;
+		noAlloc(ragged) = module.call("roundtrip", expected);
+		REQUIRE(ragged == expected);
+	}
+
+	{
+		const RaggedArray<int64_t> ragged(expected);
+		module.call("modifyNestedArray", ragged);
+		REQUIRE(ragged == expected);
+	}
+
+	{
+		RaggedArray<int64_t> ragged(expected);
+		module.call("modifyNestedArray", ragged);
+		REQUIRE(ragged._values == (std::vector<int64_t> {2, 2, 4, 2, 1}));
+	}
+
+	// Arrays of numbers are not ragged
+	REQUIRE_THROWS_AS(module.call<RaggedArray<int64_t>>("getArray"), JuliaCppException);
+	REQUIRE_THROWS_AS(module.call<RaggedArray<double>>("getAnyArray"), JuliaCppException);
+}
+
+TEST_CASE("Bool vectors")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+
+	std::vector<bool> mask(130);
+	for (size_t i = 0; i < mask.size(); i++)
+		mask[i] = (i % 3 == 0) || (i > 120);
+
+	{
+		std::vector<bool> result = module.call("roundtrip", mask);
+		REQUIRE(result == mask);
+	}
+
+	{
+		std::vector<bool> result = module.call("getBoolArray");
+		REQUIRE(result == (std::vector<bool> {true, false, true}));
+	}
+
+	{
+		std::vector<bool> result;
+		noAlloc(result) = module.call("roundtrip", mask);
+		REQUIRE(result == mask);
+	}
+
+	{
+		const std::vector<std::vector<bool>> masks { mask, { true, false } };
+		bool typed = module.call("isBitVectorArray", masks);
+		REQUIRE(typed);
+		std::vector<std::vector<bool>> result = module.call("roundtrip", masks);
+		REQUIRE(result == masks);
+	}
+}
+
+TEST_CASE("Numeric conversion")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+
+	{
+		std::vector<int> array = module.call("getArray").convertTo<std::vector<int>>(ConversionCheck::Range);
+		REQUIRE(array == (std::vector<int> {23, 45, 67}));
+	}
+
+	{
+		const std::vector<double> in { 1.5, -2.25, 1e10 };
+		std::vector<float> out;
+		convertTo(out) = module.call("roundtrip", in);
+		REQUIRE(out == (std::vector<float> {1.5f, -2.25f, 1e10f}));
+		REQUIRE_THROWS_AS(convertTo(out, ConversionCheck::Exact) = module.call("roundtrip", std::vector<double> {0.1}), JuliaCppException);
+	}
+
+	{
+		int32_t out[2];
+		convertTo(out) = module.call("roundtrip", std::array<int16_t, 2> {-3, 7});
+		REQUIRE(out[0] == -3);
+		REQUIRE(out[1] == 7);
+		REQUIRE_THROWS_AS(convertTo(out, ConversionCheck::Range) = module.call("roundtrip", std::array<int64_t, 2> {1, (int64_t)1 << 40}), JuliaCppException);
+	}
+
+	{
+		float value = module.call("roundtrip", (int64_t)42).convertTo<float>();
+		REQUIRE(value == 42.0f);
+	}
+}
+
+TEST_CASE("Homogeneous Array{Any}")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+
+	resetUnboxStats();
+
+	std::vector<double> array = module.call("getAnyArray");
+	REQUIRE(array == (std::vector<double> {1.5, 2.5, -3.5}));
+	REQUIRE(getUnboxStats().fastPathElements == 3);
+	REQUIRE(getUnboxStats().slowPathElements == 0);
+
+	std::array<std::vector<int64_t>, 2> arrayOfArrays = module.call("getArrayOfArrays2");
+	REQUIRE(getUnboxStats().slowPathElements == 2);
+
+	REQUIRE_THROWS_AS(module.call<std::vector<float>>("getAnyArray"), JuliaCppException);
+}
@@ -50,3 +50,41 @@ TEST_CASE("Errors")
 	REQUIRE_THROWS_AS(JuliaModule errorModule("NOTEXISTING.jl", "NOTEXISTING_MODULE"), JuliaCppException);
 	REQUIRE_THROWS_AS(JuliaModule errorModule("../test/test.jl", "NOTEXISTING_MODULE"), JuliaCppException);
 }
+
+TEST_CASE("Non-throwing calls")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+
+	auto success = module.tryCall<int64_t>("roundtrip", (int64_t)3);
+	REQUIRE(success);
+	REQUIRE(success.value() == 3);
+	REQUIRE(success.errorType() == nullptr);
+
+	auto failure = module.tryCall<void>("errorFunction");
+	REQUIRE(!failure);
+	REQUIRE(std::string(failure.errorType()) == "ErrorException");
+	REQUIRE(failure.exception() != nullptr);
+	REQUIRE(failure.message().find("error") != std::string::npos);
+	REQUIRE(jl_exception_occurred() == nullptr);
+
+	auto wrongType = module.tryCall<std::string>("roundtrip", true);
+	REQUIRE(!wrongType);
+	REQUIRE(std::string(wrongType.errorType()) == "JuliaCppException");
+	REQUIRE(wrongType.exception() == nullptr);
+	REQUIRE(wrongType.valueOr("default") == "default");
+	REQUIRE_THROWS_AS(wrongType.value(), JuliaCppException);
+
+	REQUIRE(!module.tryCall<void>("NOTEXISTING"));
+
+	for (int i = 0; i < 100; i++)
+		REQUIRE(!module.tryCall<void>("errorFunction"));
+
+	// Loading errors of lazy modules are returned as well
+	JuliaModule lazy("NOTEXISTING.jl", "NOTEXISTING_MODULE", LoadPolicy::Lazy);
+	auto loadFailure = lazy.tryCall<void>("roundtrip");
+	REQUIRE(!loadFailure);
+	REQUIRE(loadFailure.exception() != nullptr);
+	REQUIRE(!lazy.isLoaded());
+	REQUIRE(jl_exception_occurred() == nullptr);
+}
@@ -1,3 +1,4 @@
+#define JULIACPP_ENABLE_HOT_RELOAD
 #include "juliacpp.hpp"
 #include "catch.hpp"
 
@@ -18,6 +19,9 @@ TEST_CASE("Literals/rvalues")
 	REQUIRE(module.call<uint64_t>("roundtrip", (uint64_t)42) == 42);
 	REQUIRE(module.call<float>("roundtrip", 1.234f) == 1.234f);
 	REQUIRE(module.call<double>("roundtrip", 1.234) == 1.234);
+	REQUIRE(module.call<Float16>("roundtrip", Float16(1.5f)) == 1.5f);
+	REQUIRE(module.call<std::complex<float>>("roundtrip", std::complex<float>(1.5f, -2.0f)) == std::complex<float>(1.5f, -2.0f));
+	REQUIRE(module.call<std::complex<double>>("roundtrip", std::complex<double>(1.234, 5.678)) == std::complex<double>(1.234, 5.678));
 
 	REQUIRE(module.call<std::string>("roundtrip", "tΣster") == "tΣster");
 	REQUIRE(module.call<std::string>("roundtrip", std::string("tΣster")) == "tΣster");
@@ -27,6 +31,8 @@ TEST_CASE("Literals/rvalues")
 		REQUIRE((module.call<std::array<uint8_t, 3>>("roundtrip", std::array<uint8_t, 3> {1,2,3}) == std::array<uint8_t, 3> {1,2,3}));
 		REQUIRE(module.call<std::vector<int>>("roundtrip", std::vector<int> {1,2,3,4}) == (std::vector<int> {1,2,3,4}));
 		REQUIRE(module.call<std::vector<std::string>>("roundtrip", std::vector<const char*> {"a", "bc"}) == (std::vector<std::string> {"a", "bc"}));
+		REQUIRE(module.call<std::vector<std::complex<double>>>("roundtrip", std::vector<std::complex<double>> {{1, 2}, {3, -4}}) == (std::vector<std::complex<double>> {{1, 2}, {3, -4}}));
+		REQUIRE(module.call<std::vector<Float16>>("roundtrip", std::vector<Float16> {0.5f, -2.0f, 65504.0f}) == (std::vector<Float16> {0.5f, -2.0f, 65504.0f}));
 	}
 
 }
@@ -172,6 +178,21 @@ TEST_CASE("Manually handling jl_value_t*")
 	REQUIRE(b == "tester");
 }
 
+TEST_CASE("Symbol interning")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+
+	const std::string name = "roundtrip";
+	jl_sym_t* symbol = Impl::internSymbol(name);
+	REQUIRE(symbol == jl_symbol("roundtrip"));
+	REQUIRE(Impl::internSymbol(name) == symbol);
+	REQUIRE(JULIACPP_SYMBOL("roundtrip") == symbol);
+	REQUIRE(KeywordArgs("roundtrip", 1.0)._map.at(name)._symbol == symbol);
+	int value = module.call(name, 3);
+	REQUIRE(value == 3);
+}
+
 TEST_CASE("Keyword arguments")
 {
 	using namespace jlcpp;
@@ -203,4 +224,477 @@ TEST_CASE("Keyword arguments")
 	REQUIRE(b == "tester");
 	REQUIRE(c == false);
 	REQUIRE(e == "default");
+
+	// Keyword values are boxed before the call and survive a collection
+	KeywordArgs keywords("named2", named2);
+	module.call("collectGarbage");
+	jlcpp::tie(a, b, c, d) = module.call("keywordArgsFunction", 123456, "tester", std::move(keywords));
+	REQUIRE(d == named2);
+}
+
+TEST_CASE("Package")
+{
+	using namespace jlcpp;
+	JuliaModule module(Package("JuliaCppTestPackage", "../test/packages"));
+
+	REQUIRE(module.call<int64_t>("packageFunction", (int64_t)21) == 42);
+}
+
+TEST_CASE("Module registry")
+{
+	using namespace jlcpp;
+	auto module = sharedModule("../test/test.jl", "JuliaCppTests");
+
+	REQUIRE(module == sharedModule("../test/../test/test.jl", "JuliaCppTests"));
+	REQUIRE(ModuleRegistry::instance().contains("../test/test.jl", "JuliaCppTests"));
+	REQUIRE(module->call<int64_t>("roundtrip", (int64_t)42) == 42);
+
+	ModuleRegistry::instance().reload("../test/test.jl", "JuliaCppTests");
+	REQUIRE(module->call<int64_t>("roundtrip", (int64_t)42) == 42);
+
+	REQUIRE_THROWS_AS(ModuleRegistry::instance().reload("NOTEXISTING.jl"), JuliaCppException);
+
+	ModuleRegistry::instance().clear();
+	REQUIRE_FALSE(ModuleRegistry::instance().contains("../test/test.jl", "JuliaCppTests"));
+}
+
+#if defined(JULIACPP_ENABLE_HOT_RELOAD) && defined(__linux__)
+TEST_CASE("Hot reload")
+{
+	using namespace jlcpp;
+	const std::string filePath = "hotreload_test.jl";
+	auto writeModule = [&](int value)
+	{
+		std::ofstream file(filePath);
+		file << "module JuliaCppHotReload\nvalue() = " << value << "\nend\n";
+	};
+
+	writeModule(1);
+	JuliaModule module(filePath, "JuliaCppHotReload");
+	HotReloader reloader(module);
+
+	REQUIRE(module.call<int64_t>("value") == 1);
+	REQUIRE_FALSE(reloader.poll());
+
+	writeModule(1);
+	REQUIRE_FALSE(reloader.poll()); // same content
+
+	writeModule(2);
+	REQUIRE(reloader.poll());
+	REQUIRE(module.call<int64_t>("value") == 2);
+
+	std::remove(filePath.c_str());
+}
+#endif
+
+TEST_CASE("Staged reload")
+{
+	using namespace jlcpp;
+	const std::string filePath = "stagedreload_test.jl";
+	auto writeModule = [&](const std::string& body)
+	{
+		std::ofstream file(filePath);
+		file << "module JuliaCppStagedReload\n" << body << "\nend\n";
+	};
+
+	writeModule("value(x) = x + 1");
+	JuliaModule module(filePath, "JuliaCppStagedReload");
+	REQUIRE(module.call<int64_t>("value", (int64_t)1) == 2);
+
+	writeModule("value(x) = x + 2");
+	module.stagedReload();
+	REQUIRE(module.call<int64_t>("value", (int64_t)1) == 3);
+
+	// A broken version is not switched to
+	writeModule("value(x) = x +");
+	REQUIRE_THROWS_AS(module.stagedReload(), JuliaCppException);
+	REQUIRE(module.call<int64_t>("value", (int64_t)1) == 3);
+
+	std::remove(filePath.c_str());
+}
+
+TEST_CASE("Executor thread")
+{
+	using namespace jlcpp;
+
+	// Julia is already initialized by main, so only the thread handling is tested here
+	std::thread::id initThread;
+	JuliaExecutor executor([&] { initThread = std::this_thread::get_id(); });
+
+	executor.ready().get();
+	REQUIRE(executor.submit([] { return std::this_thread::get_id(); }).get() == initThread);
+	REQUIRE(executor.submit([] { return 42; }).get() == 42);
+
+	auto failing = executor.submit([]() -> int { throw std::runtime_error("task"); });
+	REQUIRE_THROWS_AS(failing.get(), std::runtime_error);
+
+	std::atomic<bool> ran(false);
+	JuliaExecutor failingInit([] { throw std::runtime_error("init"); });
+	auto skipped = failingInit.submit([&] { ran = true; });
+	REQUIRE_THROWS_AS(failingInit.ready().get(), std::runtime_error);
+	REQUIRE_THROWS_AS(skipped.get(), std::runtime_error);
+	REQUIRE(!ran);
+	REQUIRE_THROWS_AS(failingInit.submit([] { return 1; }), JuliaCppException);
+}
+
+TEST_CASE("Init options")
+{
+	using namespace jlcpp;
+
+	REQUIRE(InitOptions::lowLatency()._optLevel == 1);
+	REQUIRE(InitOptions::maxThroughput()._optLevel == 3);
+	REQUIRE(InitOptions::maxThroughput()._checkBounds == InitOptions::CheckBounds::Default);
+
+	// Julia is already running
+	REQUIRE_THROWS_AS(initJulia(InitOptions::lowLatency()), JuliaCppException);
+}
+
+TEST_CASE("Compile trace")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+	const std::string filePath = "compile_trace_test.jl";
+	std::remove(filePath.c_str());
+
+	CompileTrace::instance().startRecording(filePath);
+	module.call("roundtrip", (int64_t)1);
+	module.call("roundtrip", (int64_t)2);
+	module.call("roundtrip2", 1.0, "tester");
+	// Staged modules are recorded under the name of the normally loaded module
+	module.stagedReload();
+	float value = module.call("roundtrip", 1.5f);
+	REQUIRE(value == 1.5f);
+	// Failed and keyword calls are not recorded
+	REQUIRE(!module.tryCall<void>("errorFunction"));
+	module.call("keywordArgsFunction", (int64_t)1, "tester", KeywordArgs("named1", true));
+	CompileTrace::instance().stopRecording();
+	module.call("roundtrip", 1.0);
+
+	std::ifstream file(filePath);
+	size_t lines = 0;
+	for (std::string line; std::getline(file, line); )
+		lines++;
+
+	REQUIRE(lines == 3);
+	REQUIRE(CompileTrace::instance().replay(filePath) == 3);
+
+	std::remove(filePath.c_str());
+}
+
+TEST_CASE("Startup profile")
+{
+	using namespace jlcpp;
+	auto& profile = StartupProfile::instance();
+	profile.clear();
+	profile.enable();
+
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+	module.call("roundtrip", (int64_t)1);
+	module.call("roundtrip", (int64_t)2);
+
+	profile.enable(false);
+	module.call("roundtrip2", 1.0, "tester");
+
+	const auto phases = profile.getPhases();
+	REQUIRE(phases.size() == 2);
+	REQUIRE(phases[0]._kind == StartupPhase::Kind::Load);
+	REQUIRE(phases[0]._name == "../test/test.jl");
+	REQUIRE(phases[1]._kind == StartupPhase::Kind::FirstCall);
+	REQUIRE(phases[1]._name == "roundtrip");
+	REQUIRE(profile.totalSeconds(StartupPhase::Kind::Load) == phases[0]._seconds);
+
+	profile.clear();
+	REQUIRE(profile.getPhases().empty());
+}
+
+TEST_CASE("Lazy loading")
+{
+	using namespace jlcpp;
+
+	JuliaModule module("../test/test.jl", "JuliaCppTests", LoadPolicy::Lazy);
+	REQUIRE(!module.isLoaded());
+	REQUIRE(module.call<int64_t>("roundtrip", (int64_t)3) == 3);
+	REQUIRE(module.isLoaded());
+
+	JuliaModule warmed("../test/test.jl", "JuliaCppTests", LoadPolicy::Lazy);
+	warmed.ensureLoaded();
+	REQUIRE(warmed.isLoaded());
+
+	// Errors surface on first use instead of in the constructor
+	JuliaModule missing("../test/does_not_exist.jl", "Missing", LoadPolicy::Lazy);
+	REQUIRE_THROWS_AS(missing.call("roundtrip", (int64_t)3), JuliaCppException);
+	REQUIRE(!missing.isLoaded());
+}
+
+TEST_CASE("Call stats")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+	resetCallStats();
+
+	const std::vector<double> array { 1.0, 2.0, 3.0 };
+	for (int i = 0; i < 3; i++)
+		std::vector<double> result = module.call("roundtrip", array);
+
+	auto stats = getCallStats();
+#ifndef JULIACPP_ENABLE_CALL_STATS
+	// Nothing is recorded without the define
+	REQUIRE(stats.empty());
+#else
+	auto it = std::find_if(stats.begin(), stats.end(), [](const CallStats& s) { return s._functionName == "JuliaCppTests.roundtrip"; });
+	REQUIRE(it != stats.end());
+
+	REQUIRE(it->phase(CallPhase::Box)._count == 3);
+	REQUIRE(it->phase(CallPhase::Dispatch)._count == 3);
+	REQUIRE(it->phase(CallPhase::Exception)._count == 3);
+	REQUIRE(it->phase(CallPhase::Unbox)._count == 3);
+	REQUIRE(it->phase(CallPhase::Dispatch)._p50Seconds <= it->phase(CallPhase::Dispatch)._p99Seconds);
+	REQUIRE(it->_bytesToJulia == 3 * 3 * sizeof(double));
+	REQUIRE(it->_bytesFromJulia == 3 * 3 * sizeof(double));
+#endif
+}
+
+// Calls, GC pauses and their trace spans are only recorded with call stats
+#ifdef JULIACPP_ENABLE_CALL_STATS
+TEST_CASE("GC stats")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+	module.call("allocateArrays", (int64_t)1);
+	module.call("collectGarbage");
+	resetCallStats();
+
+	module.call("allocateArrays", (int64_t)1000);
+	module.call("collectGarbage");
+
+	auto stats = getCallStats();
+	auto find = [&](const std::string& name) { return std::find_if(stats.begin(), stats.end(), [&](const CallStats& s) { return s._functionName == name; }); };
+
+	auto allocating = find("JuliaCppTests.allocateArrays");
+	REQUIRE(allocating != stats.end());
+	REQUIRE(allocating->_gcAllocatedBytes >= 1000 * 100 * sizeof(double));
+
+	auto collecting = find("JuliaCppTests.collectGarbage");
+	REQUIRE(collecting != stats.end());
+	REQUIRE(collecting->_callsWithGc == 1);
+	if (gcCollectionsAvailable())
+		REQUIRE(collecting->_gcCollections >= 1);
+	else
+		REQUIRE(collecting->_gcCollections == 0);
+	REQUIRE(collecting->_gcPauseSeconds > 0.0);
+}
+
+TEST_CASE("Trace recorder")
+{
+	using namespace jlcpp;
+	const std::string filePath = "trace_test.json";
+	auto& recorder = TraceRecorder::instance();
+
+	recorder.start(16);
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+	for (int i = 0; i < 10; i++)
+		module.call<int64_t>("roundtrip", (int64_t)i);
+	recorder.stop();
+	module.call<int64_t>("roundtrip", (int64_t)1);
+
+	// Only the latest spans are kept
+	REQUIRE(recorder.size() == 16);
+
+	recorder.write(filePath);
+	std::ifstream file(filePath);
+	const std::string trace((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	REQUIRE(trace.find("{\"traceEvents\":[") == 0);
+	REQUIRE(trace.find("\"cat\":\"call\"") != std::string::npos);
+	REQUIRE(trace.find("\"name\":\"dispatch\"") != std::string::npos);
+	file.close();
+
+	// First calls are marked, later ones are not
+	recorder.start();
+	JuliaModule other("../test/test.jl", "JuliaCppTests");
+	other.call("roundtrip", (int64_t)1);
+	other.call("roundtrip", (int64_t)2);
+	recorder.stop();
+
+	recorder.write(filePath);
+	std::ifstream secondFile(filePath);
+	const std::string secondTrace((std::istreambuf_iterator<char>(secondFile)), std::istreambuf_iterator<char>());
+	const size_t firstCall = secondTrace.find("\"cat\":\"first-call\"");
+	REQUIRE(firstCall != std::string::npos);
+	REQUIRE(secondTrace.find("\"cat\":\"first-call\"", firstCall + 1) == std::string::npos);
+
+	std::remove(filePath.c_str());
+}
+#endif
+
+TEST_CASE("GC control")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+
+	REQUIRE(jl_gc_is_enabled());
+	{
+		GcPause pause;
+		REQUIRE(!jl_gc_is_enabled());
+		{
+			GcPause nested;
+		}
+		REQUIRE(!jl_gc_is_enabled());
+
+		// Boxing arguments must not enable the collector again
+		module.call("roundtrip", (int64_t)1);
+		REQUIRE(!jl_gc_is_enabled());
+	}
+	REQUIRE(jl_gc_is_enabled());
+
+	collectNow();
+	collectNow(GcCollection::Full);
+
+	int64_t grown = 0;
+	onHeapGrowth(1000000, [&](int64_t bytes) { grown = bytes; });
+	module.call("allocateArrays", (int64_t)10);
+	REQUIRE(grown == 0);
+	module.call("allocateArrays", (int64_t)2000);
+	module.call("allocateArrays", (int64_t)1);
+	REQUIRE(grown >= 1000000);
+
+	clearHeapGrowthCallback();
+	grown = 0;
+	module.call("allocateArrays", (int64_t)2000);
+	module.call("allocateArrays", (int64_t)1);
+	REQUIRE(grown == 0);
+}
+
+TEST_CASE("Realtime calls")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+
+	RealtimeCalls realtime(module);
+	realtime.add("roundtrip", (int64_t)0);
+	REQUIRE(realtime.isRegistered<int64_t>("roundtrip"));
+	REQUIRE(!realtime.isRegistered<double>("roundtrip"));
+	REQUIRE_THROWS_AS(realtime.add("doesNotExist", 1.0), JuliaCppException);
+
+	// Julia emits the machine code on the first call
+	module.call("roundtrip", (int64_t)0);
+	REQUIRE(realtime.isCompiled<int64_t>("roundtrip"));
+
+	std::vector<RealtimeCalls::Violation> violations;
+	realtime.onViolation([&](const RealtimeCalls::Violation& violation) { violations.push_back(violation); });
+
+	{
+		RealtimeCalls::Window window(realtime);
+		REQUIRE(realtime.isActive());
+		REQUIRE(!jl_gc_is_enabled());
+
+		int64_t result = realtime.call("roundtrip", (int64_t)5);
+		REQUIRE(result == 5);
+		REQUIRE(violations.empty());
+
+		double unregistered = realtime.call("roundtrip", 1.5);
+		REQUIRE(unregistered == 1.5);
+	}
+
+	REQUIRE(!realtime.isActive());
+	REQUIRE(jl_gc_is_enabled());
+	REQUIRE(realtime.getUnregisteredCalls() == 1);
+	REQUIRE(violations.size() >= 1);
+	REQUIRE(violations[0]._kind == RealtimeCalls::Violation::Kind::Unregistered);
+	REQUIRE(violations[0]._functionName == "roundtrip");
+
+	// A registered signature that still needs JIT compilation is reported
+	realtime.add("realtimeFunction", (int16_t)0);
+	const bool compiled = realtime.isCompiled<int16_t>("realtimeFunction");
+	{
+		RealtimeCalls::Window window(realtime);
+		int16_t value = realtime.call("realtimeFunction", (int16_t)1);
+		REQUIRE(value == 2);
+		realtime.call<void>("realtimeFunction", (int16_t)2);
+	}
+	REQUIRE(realtime.getCompiledCalls() == (compiled ? 0 : 1));
+	REQUIRE(realtime.isCompiled<int16_t>("realtimeFunction"));
+	if (!compiled)
+		REQUIRE(violations.back()._kind == RealtimeCalls::Violation::Kind::Compiled);
+}
+
+TEST_CASE("Keyword schema")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+	const KwSchema keywords { "named1", "named2" };
+	REQUIRE(keywords.size() == 2);
+
+	for (int i = 0; i < 3; i++)
+	{
+		int64_t a;
+		std::string b, named2;
+		bool named1;
+		jlcpp::tie(a, b, named1, named2) = module.call("keywordArgsFunction", (int64_t)i, "arg2", keywords(true, "value"));
+		REQUIRE(a == i);
+		REQUIRE(b == "arg2");
+		REQUIRE(named1 == true);
+		REQUIRE(named2 == "value");
+	}
+
+	// Values are not kept alive after the call
+	REQUIRE(jl_array_ptr_data(keywords.layout())[1] == jl_nothing);
+
+	REQUIRE_THROWS_AS(keywords(true), JuliaCppException);
+	REQUIRE_THROWS_AS(module.call("roundtrip", 1.0, keywords(true, "value")), JuliaCppException);
+	REQUIRE(jl_array_ptr_data(keywords.layout())[1] == jl_nothing);
+}
+
+TEST_CASE("Typed keyword arguments")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+	const KwSchema keywords { "scale", "offset" };
+
+	float scale;
+	int8_t offset;
+	jlcpp::tie(scale, offset) = module.call("typedKeywordsFunction", KeywordArgs("offset", (int8_t)-3)("scale", 2.5f));
+	REQUIRE(scale == 2.5f);
+	REQUIRE(offset == -3);
+
+	jlcpp::tie(scale, offset) = module.call("typedKeywordsFunction", keywords(0.5f, (int8_t)7));
+	REQUIRE(scale == 0.5f);
+	REQUIRE(offset == 7);
+
+	jlcpp::tie(scale, offset) = module.call("typedKeywordsFunction");
+	REQUIRE(scale == 1.0f);
+	REQUIRE(offset == 0);
+
+	// The keyword types are checked by Julia
+	REQUIRE_THROWS_AS(module.call("typedKeywordsFunction", KeywordArgs("offset", 1.5)), JuliaCppException);
+}
+
+TEST_CASE("Direct invocation")
+{
+	using namespace jlcpp;
+	JuliaModule module("../test/test.jl", "JuliaCppTests");
+
+	const bool specialized = module.specialize("roundtrip", 1.0);
+#ifdef JULIACPP_HAS_DIRECT_INVOKE
+	REQUIRE(specialized);
+#else
+	REQUIRE(!specialized);
+#endif
+
+	for (int i = 0; i < 3; i++)
+	{
+		double a = module.call("roundtrip", 2.5 * i);
+		REQUIRE(a == 2.5 * i);
+	}
+
+	// Other argument types go through generic dispatch
+	std::string b = module.call("roundtrip", "tester");
+	REQUIRE(b == "tester");
+
+	REQUIRE(module.getDirectCalls("roundtrip") == (specialized ? 3 : 0));
+	REQUIRE(module.getFallbackCalls("roundtrip") == (specialized ? 1 : 0));
+
+	// Exceptions of a directly invoked method are handled like any other
+	module.specialize("errorFunction");
+	REQUIRE(!module.tryCall<void>("errorFunction"));
+	REQUIRE(jl_exception_occurred() == nullptr);
 }